@@ -0,0 +1,16 @@
+/* mandelbrot_bmp_generator benchmarking code
+ * By: John Jekel
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Includes */
+
+#include <stdint.h>
+
+/* Function Declarations */
+
+int32_t bench(void);
+
+#endif//BENCH_H
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /* Types */
 
@@ -24,14 +25,14 @@ typedef struct
 
 typedef struct
 {
-    uint_fast16_t width;//In pixels
-    uint_fast16_t height;//In pixels (number of rows)
+    uint64_t width;//In pixels
+    uint64_t height;//In pixels (number of rows)
     bpp_t bpp /* : 5 */;
 
     uint_fast16_t num_palette_colours /* : 9 */;
     palette_colour_t* palette;
 
-    uint_fast32_t row_len_bytes /* : 18 */;//Number of bytes per row
+    uint64_t row_len_bytes;//Number of bytes per row
 
     union
     {
@@ -39,27 +40,72 @@ typedef struct
         uint16_t* image_data_s;
         uint32_t* image_data_w;
     };
+    bool owns_image_data;//False if it was given to bmp_create_in(), so bmp_destroy() leaves it alone
 
 } bmp_t;
 
+//For writing an image a band of rows at a time, so the whole thing never has to be in memory at once. The file name
+//"-" means standard output; compressed images going somewhere that can't be seeked back through (ex. a pipe) are
+//buffered in memory until bmp_stream_close(), since the header needs their size
+typedef struct
+{
+    FILE* file;
+    compression_t compression;
+    size_t image_data_offset;
+    uint64_t file_size;//Bytes output so far
+    uint64_t rows_left;//Rows of the image that haven't been written yet
+    uint8_t* buffer;//Everything output so far when buffering, otherwise NULL
+    size_t buffer_capacity;
+    bool success;
+} bmp_stream_t;
+
+//Zero-copy saving for uncompressed images: the file's size is known up front, so it is mapped into memory and each
+//band is created in place (see bmp_map_next_rows()) rather than copied through stdio afterwards
+typedef struct
+{
+    int fd;
+    uint8_t* file_data;
+    size_t file_size;
+    size_t image_data_offset;
+    uint_fast16_t num_palette_colours;//Room is left for every colour the bpp allows
+    uint64_t row_len_bytes;
+    uint64_t height;
+    uint64_t rows_left;//Rows of the image that haven't been written yet
+    bool success;
+} bmp_map_t;
+
 /* Function/Class Declarations */
 
 //Creation/Destruction
-void bmp_create(bmp_t* bmp, uint_fast16_t width, uint_fast16_t height, bpp_t bpp);
+void bmp_create(bmp_t* bmp, uint64_t width, uint64_t height, bpp_t bpp);
+void bmp_create_in(bmp_t* bmp, uint64_t width, uint64_t height, bpp_t bpp, uint8_t* image_data);//image_data must hold row_len_bytes * height bytes and outlive the bitmap
 void bmp_destroy(bmp_t* bmp);
 
 //File saving
 bool bmp_save(const bmp_t* bmp, const char* file_name, compression_t compression);
 
+//Streamed file saving: the header and palette come from the first band; every band must be the same width and bpp,
+//with the bands' heights adding up to height. The file is removed if anything failed
+bool bmp_stream_open(bmp_stream_t* stream, const bmp_t* first_band, uint64_t height, const char* file_name, compression_t compression);
+bool bmp_stream_write(bmp_stream_t* stream, const bmp_t* band);//The band's rows come after the ones written before
+bool bmp_stream_close(bmp_stream_t* stream, const char* file_name);//False if any part of the file failed to save
+
+//Mapped file saving (BI_RGB only): each band is created with bmp_create_in() at bmp_map_next_rows(), then passed to
+//bmp_map_write(). bmp_map_open() fails where mapping isn't possible (ex. pipes), in which case use a bmp_stream_t
+bool bmp_map_open(bmp_map_t* map, uint64_t width, uint64_t height, bpp_t bpp, const char* file_name);//Always fails for "-"
+uint8_t* bmp_map_next_rows(const bmp_map_t* map);
+bool bmp_map_write(bmp_map_t* map, const bmp_t* band);//The palette comes from the first band
+bool bmp_map_close(bmp_map_t* map, const char* file_name);//False if any part of the file failed to save
+
 //Palette manip
 void bmp_palette_set_size(bmp_t* bmp, uint_fast16_t num_palette_colours);
 void bmp_palette_colour_set(bmp_t* bmp, uint_fast16_t colour_num, palette_colour_t colour);
 
 //Pixel access
-void bmp_px_set_1(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, bool value);
-void bmp_px_set_4(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint8_t value);
-void bmp_px_set_8(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint8_t value);
-void bmp_px_set_16(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint16_t value);
-void bmp_px_set_24(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint32_t value);
+void bmp_px_set_1(bmp_t* bmp, uint64_t x, uint64_t y, bool value);
+void bmp_px_set_4(bmp_t* bmp, uint64_t x, uint64_t y, uint8_t value);
+void bmp_px_set_8(bmp_t* bmp, uint64_t x, uint64_t y, uint8_t value);
+void bmp_px_set_16(bmp_t* bmp, uint64_t x, uint64_t y, uint16_t value);
+void bmp_px_set_24(bmp_t* bmp, uint64_t x, uint64_t y, uint32_t value);
 
 #endif//bmp_H
@@ -0,0 +1,45 @@
+/* Image formats besides bitmaps: QOI, binary PGM and binary PPM
+ * By: John Jekel
+ *
+ * Each is written from the same bands as a bmp_stream_t, but these formats store the top row first, so the bands must
+ * be given from the top of the image down (each band's rows are written last to first, since bitmaps are bottom up)
+*/
+
+#ifndef FORMATS_H
+#define FORMATS_H
+
+/* Includes */
+
+#include "bmp.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Types */
+
+typedef enum
+{
+    FORMAT_QOI,//"Quite OK Image" format: lossless, RGB
+    FORMAT_PGM,//Uncompressed 8 bit greyscale (colours are converted to their luma)
+    FORMAT_PPM//Uncompressed 8 bit RGB
+} format_t;
+
+typedef struct
+{
+    FILE* file;
+    format_t format;
+    uint64_t width;//In pixels
+    uint64_t rows_left;//Rows of the image that haven't been written yet
+    uint32_t last_px;//The last pixel written (QOI bands are encoded starting from it)
+    bool success;
+} format_stream_t;
+
+/* Function/Class Declarations */
+
+//The file name "-" means standard output; the file is removed if anything failed
+bool format_stream_open(format_stream_t* stream, format_t format, uint64_t width, uint64_t height, const char* file_name);
+bool format_stream_write(format_stream_t* stream, const bmp_t* band);//The band's rows come above the ones written before
+bool format_stream_close(format_stream_t* stream, const char* file_name);//False if any part of the file failed to save
+
+#endif//FORMATS_H
@@ -0,0 +1,95 @@
+/* Mandelbrot iteration kernels
+ * By: John Jekel
+ *
+ * src/kernels.c, src/kernels_dd.c and src/kernels_float.c are compiled once per instruction set (see CMakeLists.txt)
+ * so that a single binary contains all of them; mandelbrot.c then picks the best one the CPU supports at runtime
+*/
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/* Includes */
+
+#include "cmake_config.h"
+
+#include <stdint.h>
+
+/* Constants And Defines */
+
+//The double precision kernels check for periodic orbits from this limit on. It costs a few instructions per iteration,
+//so it is only done when the limit is high enough for interior points to dominate. The float kernels never check
+#define PERIODICITY_MIN_ITERATIONS 1000
+
+/* Types */
+
+typedef struct
+{
+    uint16_t* intensities;//The intensity buffer (64 byte aligned), which holds the rows of the image from first_row on
+    uint64_t first_row;
+    uint64_t row_stride;//Pixels from the start of one row of intensities to the next (a multiple of 32 so rows stay aligned)
+
+    double min_x, min_y;//Coordinates of pixel (0, 0)
+    double min_x_low, min_y_low;//Only for the double-double kernels: what is left of the coordinates after min_x/min_y
+    double x_step, y_step;
+
+    uint16_t max_iterations;//Points that haven't escaped after this many iterations are counted as being in the set
+
+    uint64_t min_x_px, max_x_px;//Columns to compute (max is exclusive)
+    uint64_t min_y_px, max_y_px;//Rows of the image to compute (max is exclusive)
+
+    //Only for the perturbation kernels: the orbit of the reference point (from z_0 = 0), which min_x/min_y are relative to
+    const double* reference_real;
+    const double* reference_imag;
+    uint32_t reference_length;
+} kernel_region_t;
+
+//Kernels return how many pixels of the region were inside the main cardioid or period-2 bulb (so weren't iterated)
+typedef uint64_t (*kernel_t)(const kernel_region_t* region);
+
+/* Static Function Implementations */
+
+//Where row j of the image is in a region's intensity buffer
+static inline uint16_t* kernel_region_row(const kernel_region_t* region, uint64_t j)
+{
+    return &region->intensities[(j - region->first_row) * region->row_stride];
+}
+
+/* Function/Class Declarations */
+
+uint64_t kernel_region_scalar(const kernel_region_t* region);
+uint64_t kernel_region_scalar_perturb(const kernel_region_t* region);
+uint64_t kernel_region_scalar_dd(const kernel_region_t* region);
+uint64_t kernel_region_scalar_float(const kernel_region_t* region);
+
+#if MBBMP_X86
+uint64_t kernel_region_sse2(const kernel_region_t* region);
+uint64_t kernel_region_avx(const kernel_region_t* region);
+uint64_t kernel_region_avx2(const kernel_region_t* region);//Also uses FMA
+uint64_t kernel_region_avx512(const kernel_region_t* region);//Only needs AVX-512F
+
+//Same as above, but lanes that finish are refilled with the next pixel instead of waiting for the whole vector
+uint64_t kernel_region_sse2_refill(const kernel_region_t* region);
+uint64_t kernel_region_avx_refill(const kernel_region_t* region);
+uint64_t kernel_region_avx2_refill(const kernel_region_t* region);
+uint64_t kernel_region_avx512_refill(const kernel_region_t* region);
+
+//Deep zooms: pixels are iterated as deltas from a high precision reference orbit (perturbation), rebasing as needed
+uint64_t kernel_region_sse2_perturb(const kernel_region_t* region);
+uint64_t kernel_region_avx_perturb(const kernel_region_t* region);
+uint64_t kernel_region_avx2_perturb(const kernel_region_t* region);
+uint64_t kernel_region_avx512_perturb(const kernel_region_t* region);
+
+//Moderately deep zooms: every pixel is iterated in double-double arithmetic (see src/kernels_dd.c)
+uint64_t kernel_region_sse2_dd(const kernel_region_t* region);
+uint64_t kernel_region_avx_dd(const kernel_region_t* region);
+uint64_t kernel_region_avx2_dd(const kernel_region_t* region);
+uint64_t kernel_region_avx512_dd(const kernel_region_t* region);
+
+//Zoomed out images: twice the lanes of the double kernels, in single precision (see src/kernels_float.c)
+uint64_t kernel_region_sse2_float(const kernel_region_t* region);
+uint64_t kernel_region_avx_float(const kernel_region_t* region);
+uint64_t kernel_region_avx2_float(const kernel_region_t* region);
+uint64_t kernel_region_avx512_float(const kernel_region_t* region);
+#endif
+
+#endif//KERNELS_H
@@ -8,24 +8,73 @@
 /* Includes */
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
 #include "bmp.h"
+#include "palette.h"
+
+/* Constants And Defines */
+
+#define MB_DEFAULT_MAX_ITERATIONS 255
+
+//mb_precise_t is fixed point with this many 32 bit limbs, the most significant MB_PRECISE_INTEGER_LIMBS of which are
+//before the point (so there are 224 bits after it, enough to place zooms far deeper than 1e-30)
+#define MB_PRECISE_LIMBS 8
+#define MB_PRECISE_INTEGER_LIMBS 1
 
 /* Types */
 
+//Two's complement; limbs[0] is the least significant
+typedef struct
+{
+    uint32_t limbs[MB_PRECISE_LIMBS];
+} mb_precise_t;
+
+//How pixels are iterated; the cheapest one that can still tell neighbouring pixels apart is picked for each image
+typedef enum
+{
+    MB_PRECISION_FLOAT,//Twice the lanes per vector, for zoomed out images
+    MB_PRECISION_DOUBLE,
+    MB_PRECISION_DOUBLE_DOUBLE,//About twice the bits of a double, for zooms doubles can't resolve
+    MB_PRECISION_PERTURB//Deltas from a high precision reference orbit, for zooms past what double-double can resolve
+} mb_precision_t;
+
 typedef struct
 {
-    uint16_t x_pixels, y_pixels;
+    uint64_t x_pixels, y_pixels;
     double min_x, max_x, min_y, max_y;
+    uint16_t max_iterations;//255, 1000, 4096 and 65535 use kernels specialised for that limit, which are a bit faster
+
+    //Optional: the same bounds with more precision than doubles have (see mb_parse_precise()). Deep zooms (where the
+    //step between pixels is too small for doubles) need these to be placed accurately
+    bool precise;
+    mb_precise_t precise_min_x, precise_max_x, precise_min_y, precise_max_y;
 
     //TODO colour stuffs here too
 
 } mb_config_t;
 
+//The kinds of image that can be rendered (see the mb_render_* function of the same name)
+typedef enum {MB_RENDER_BW, MB_RENDER_GREY_8, MB_RENDER_COLOUR, MB_RENDER_COLOUR_8, MB_RENDER_GREY_4, MB_RENDER_COLOUR_4} mb_render_t;
+
+struct mb_generation_state;//Private to mandelbrot.c
+
+//Holds a band of rows of the image (which may be all of it). Pixel (x, first_row + y) is at x + (y * row_stride)
 typedef struct
 {
     mb_config_t config;
+    uint64_t interior_px;//Pixels inside the main cardioid or period-2 bulb, which were given max_iterations without iterating
+    uint64_t filled_px;//Pixels filled in by border tracing without being iterated
+    uint64_t mirrored_px;//Pixels copied from their reflection across the real axis without being iterated
+    mb_precision_t precision;//What the pixels were iterated with
+    uint64_t row_stride;//Rows of intensities are padded so each starts 64 byte aligned
+
+    uint64_t first_row;//The row of the image the band currently starts at
+    uint64_t num_rows;//How many rows of the image the band currently holds
+    uint64_t max_rows;//How many it has room for
+    struct mb_generation_state* state;//Whatever is worked out once per image (ex. the reference orbit of deep zooms)
 
-    uint16_t intensities[];
+    alignas(64) uint16_t intensities[];
 
 } mb_intensities_t;
 
@@ -33,14 +82,41 @@ typedef struct
 
 void mb_set_total_active_threads(uint16_t threads);
 
+//Iteration kernel selection (by default the best one the CPU supports is used)
+bool mb_set_kernel(const char* name);//"auto", "scalar", "sse2", "avx", "avx2" or "avx512"; false if unknown or unsupported by this CPU
+const char* mb_get_kernel(void);
+void mb_set_lane_refill(bool enabled);//Refill SIMD lanes with new pixels as they finish rather than waiting for the whole vector
+void mb_set_border_tracing(bool enabled);//Only compute rectangle borders, filling rectangles whose border is in the set (Mariani-Silver)
+bool mb_get_border_tracing(void);
+void mb_set_mirroring(bool enabled);//Copy rows that are reflections of others across the real axis instead of computing them (on by default)
+bool mb_set_precision(const char* name);//"auto" (the default), "float", "double", "dd" or "perturb"; false if unknown
+void mb_set_palette(const palette_t* palette);//Colours for the colour renders (must outlive them); NULL for the defaults ("bands" for 4 and 8 bit, "rgb" for 24 bit)
+
+bool mb_parse_precise(const char* string, mb_precise_t* result);//Decimal (ex. "-1.7490121e-20"); false if invalid or out of range
+
 //Dealing with intensities
-mb_intensities_t* mb_generate_intensities(const mb_config_t* config);
+mb_intensities_t* mb_generate_intensities(const mb_config_t* config);//The whole image at once; NULL if out of memory
 void mb_destroy_intensities(mb_intensities_t* intensities);
 
-//Dealing with rendering
+//Streaming: images too big to hold at once are generated a band of rows at a time, reusing the same memory for each.
+//The pixel counts above add up over all of the bands generated
+mb_intensities_t* mb_create_band(const mb_config_t* config, uint64_t max_rows);//Destroy with mb_destroy_intensities(); NULL if out of memory
+void mb_generate_band(mb_intensities_t* band, uint64_t first_row, uint64_t num_rows);//num_rows must be at most max_rows
+
+//Dealing with rendering (only the rows the intensities currently hold, so bitmap_to_init is num_rows tall). image_data
+//is where the pixels go (ex. from bmp_map_next_rows()), or NULL for the bitmap to allocate its own
+bpp_t mb_render_bpp(mb_render_t type);
+void mb_render(const mb_intensities_t* intensities, mb_render_t type, bmp_t* bitmap_to_init, uint8_t* image_data);
 void mb_render_bw(const mb_intensities_t* intensities, bmp_t* bitmap_to_init);//1 bit bitmap
 void mb_render_grey_8(const mb_intensities_t* intensities, bmp_t* bitmap_to_init);//8 bit bitmap
 void mb_render_colour(const mb_intensities_t* intensities, bmp_t* bitmap_to_init);//24 bit bitmap
 void mb_render_colour_8(const mb_intensities_t* intensities, bmp_t* bitmap_to_init);//8 bit bitmap
+void mb_render_grey_4(const mb_intensities_t* intensities, bmp_t* bitmap_to_init);//4 bit bitmap (16 shades)
+void mb_render_colour_4(const mb_intensities_t* intensities, bmp_t* bitmap_to_init);//4 bit bitmap (16 colours)
+
+//Fused generating and rendering: each thread colours the rows it generates while they are still in cache, so the whole
+//image's intensities never exist. Border tracing isn't used, since there are no intensities to trace
+bool mb_render_direct(const mb_config_t* config, mb_render_t type, bmp_t* bitmap_to_init);//False if out of memory (bitmap_to_init is then left uninitialized)
+bool mb_render_band_direct(mb_intensities_t* band, uint64_t first_row, uint64_t num_rows, mb_render_t type, bmp_t* bitmap_to_init, uint8_t* image_data);//band may have max_rows = 0; false if out of memory (bitmap_to_init must still be destroyed)
 
 #endif//MANDELBROT_H
@@ -0,0 +1,45 @@
+/* Colour maps
+ * By: John Jekel
+ *
+ * A palette says what colour each escape count gets. Before a render it is compiled into a table with an entry for
+ * every intensity from 0 to max_iterations, so colouring a pixel is a single lookup whatever the palette is
+*/
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+/* Includes */
+
+#include "bmp.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Types */
+
+typedef enum
+{
+    PALETTE_STRETCH,//The colours are spread evenly over the escape counts, the first for points nearest the set
+    PALETTE_CYCLE//Escape count n gets colour n % num_colours
+} palette_mapping_t;
+
+typedef struct
+{
+    palette_mapping_t mapping;
+    palette_colour_t inside;//Points in the set (that haven't escaped after max_iterations)
+    uint32_t num_colours;
+    palette_colour_t* colours;//For points that escaped
+} palette_t;
+
+/* Function/Class Declarations */
+
+//Creation/Destruction
+bool palette_builtin(palette_t* palette, const char* name);//"grey", "bands" or "rgb"; false if unknown
+bool palette_load(palette_t* palette, const char* file_name);//See example.pal for the format; false if it can't be read
+void palette_destroy(palette_t* palette);
+
+//Compiling for a render; the tables need max_iterations + 1 entries
+void palette_compile_24(const palette_t* palette, uint16_t max_iterations, uint32_t* colours);//The 3 bytes of each pixel in file order (lowest byte first)
+uint_fast16_t palette_compile_indexed(const palette_t* palette, uint16_t max_iterations, uint8_t* indices, palette_colour_t* bmp_palette, uint_fast16_t max_colours);//Returns how many bmp_palette colours are used
+
+#endif//PALETTE_H
@@ -0,0 +1,42 @@
+/* Deep zoom (perturbation) support
+ * By: John Jekel
+*/
+
+#ifndef PERTURB_H
+#define PERTURB_H
+
+/* Includes */
+
+#include "mandelbrot.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Types */
+
+typedef struct
+{
+    double* real;//Orbit of the reference point (the centre of the image), from z_0 = 0 until it escapes or hits the limit
+    double* imag;
+    uint32_t length;
+
+    double min_x, min_y;//Coordinates of pixel (0, 0) relative to the reference point
+    double x_step, y_step;
+} perturb_reference_t;
+
+//Bounds for the double-double kernels, each coordinate as the sum of a high and a low double
+typedef struct
+{
+    double min_x, min_x_low;
+    double min_y, min_y_low;
+    double x_step, y_step;
+} perturb_dd_origin_t;
+
+/* Function/Class Declarations */
+
+mb_precision_t perturb_precision_needed(const mb_config_t* config);//The cheapest precision that can resolve the step between pixels
+void perturb_dd_origin(perturb_dd_origin_t* origin, const mb_config_t* config);
+void perturb_reference_create(perturb_reference_t* reference, const mb_config_t* config);
+void perturb_reference_destroy(perturb_reference_t* reference);
+
+#endif//PERTURB_H
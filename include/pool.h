@@ -0,0 +1,24 @@
+/* Persistent worker thread pool
+ * By: John Jekel
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+/* Includes */
+
+#include <stdint.h>
+
+/* Types */
+
+typedef void (*pool_job_t)(void* data, uint32_t job_num);
+
+/* Function/Class Declarations */
+
+void pool_set_threads(uint16_t threads);//Only (re)creates the workers if the number of threads changes
+void pool_run(pool_job_t job, void* data, uint32_t num_jobs);//Runs job(data, 0..num_jobs-1) on the workers, blocking until all are done
+uint16_t pool_threads(void);//How many threads pool_run() runs jobs on (1 if there is no pool yet)
+uint16_t pool_worker_num(void);//Which of the pool_threads() the calling job is running on, so it can use per thread scratch space
+void pool_destroy(void);
+
+#endif//POOL_H
@@ -0,0 +1,210 @@
+/* mandelbrot_bmp_generator benchmarking code
+ * By: John Jekel
+*/
+
+/* Constants And Defines */
+
+#define RUNS 3//The best of these is reported
+
+//Encoders write here (in the current directory, so that it is a real file like the ones images are saved to)
+#define BENCH_FILE_NAME "mbbmp_bench.tmp"
+
+/* Includes */
+
+#include "bench.h"
+
+#include "mandelbrot.h"
+#include "bmp.h"
+#include "formats.h"
+#include "cpp.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <inttypes.h>
+
+/* Static Function Declarations */
+
+static double seconds_since(const struct timespec* start);
+static double bench_intensities(const mb_config_t* config, uint64_t* interior_px);
+static void bench_encoders(const mb_config_t* config);
+static double bench_save(const bmp_t* image, bool bitmap, compression_t compression, format_t format, uint64_t* file_size);
+
+/* Function Implementations */
+
+int32_t bench(void)
+{
+    static const struct
+    {
+        const char* name;
+        mb_config_t config;
+    } scenes[] =
+    {
+        {"classic", {.x_pixels = 1920, .y_pixels = 1080, .min_x = -2.3, .max_x = 0.8, .min_y = -1.1, .max_y = 1.1, .max_iterations = MB_DEFAULT_MAX_ITERATIONS}},
+        {"nice_spirals", {.x_pixels = 1920, .y_pixels = 1080, .min_x = -0.7473, .max_x = -0.7433, .min_y = 0.1112, .max_y = 0.1147, .max_iterations = MB_DEFAULT_MAX_ITERATIONS}}
+    };
+    static const char* const kernels[] = {"scalar", "sse2", "avx", "avx2", "avx512"};
+
+    uint16_t threads = cpp_hw_concurrency();
+    mb_set_total_active_threads(threads);
+    fprintf(stderr, "Benchmarking intensity generation using %hu threads (best of %u runs)\n\n", threads, RUNS);
+
+    fprintf(stderr, "%-14s%-10s%14s%14s%14s%14s%14s\n", "scene", "kernel", "Mpx/s", "refill Mpx/s", "traced Mpx/s", "float Mpx/s", "interior px");
+    for (size_t i = 0; i < (sizeof(scenes) / sizeof(scenes[0])); ++i)
+    {
+        const double megapixels = (scenes[i].config.x_pixels * scenes[i].config.y_pixels) / 1e6;
+
+        for (size_t j = 0; j < (sizeof(kernels) / sizeof(kernels[0])); ++j)
+        {
+            if (!mb_set_kernel(kernels[j]))
+            {
+                fprintf(stderr, "%-14s%-10s%14s%14s%14s%14s%14s\n", scenes[i].name, kernels[j], "unsupported", "unsupported", "unsupported", "unsupported", "");
+                continue;
+            }
+
+            //Also report how many pixels were skipped for being inside the main cardioid/period-2 bulb
+            uint64_t interior_px;
+            mb_set_precision("double");//Otherwise zoomed out scenes would use the float kernels for everything
+            mb_set_lane_refill(false);
+            double normal = megapixels / bench_intensities(&scenes[i].config, &interior_px);
+            mb_set_lane_refill(true);
+            double refill = megapixels / bench_intensities(&scenes[i].config, &interior_px);
+            mb_set_lane_refill(false);
+            mb_set_border_tracing(true);
+            uint64_t traced_interior_px;
+            double traced = megapixels / bench_intensities(&scenes[i].config, &traced_interior_px);
+            mb_set_border_tracing(false);
+            mb_set_precision("float");
+            uint64_t float_interior_px;
+            double single = megapixels / bench_intensities(&scenes[i].config, &float_interior_px);
+
+            fprintf(stderr, "%-14s%-10s%14.2f%14.2f%14.2f%14.2f%14lu\n", scenes[i].name, kernels[j], normal, refill, traced, single, (unsigned long) interior_px);
+        }
+    }
+
+    mb_set_kernel("auto");
+    mb_set_precision("auto");
+    mb_set_lane_refill(false);
+
+    bench_encoders(&scenes[1].config);
+    return 0;
+}
+
+/* Static Function Implementations */
+
+static double seconds_since(const struct timespec* start)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static double bench_intensities(const mb_config_t* config, uint64_t* interior_px)
+{
+    double best = 0;
+
+    for (uint_fast8_t i = 0; i < RUNS; ++i)
+    {
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        mb_intensities_t* intensities = mb_generate_intensities(config);
+        double seconds = seconds_since(&start);
+        *interior_px = intensities->interior_px;
+        mb_destroy_intensities(intensities);
+
+        if (!i || (seconds < best))
+            best = seconds;
+    }
+
+    return best;
+}
+
+static void bench_encoders(const mb_config_t* config)
+{
+    static const struct
+    {
+        const char* name;
+        bool indexed;//Encodes the colour_8 render rather than the colour one
+        bool bitmap;
+        compression_t compression;
+        format_t format;
+    } encoders[] =
+    {
+        {"bmp", false, true, BI_RGB, FORMAT_QOI},
+        {"qoi", false, false, BI_RGB, FORMAT_QOI},
+        {"ppm", false, false, BI_RGB, FORMAT_PPM},
+        {"bmp (rle8)", true, true, BI_RLE8, FORMAT_QOI},
+        {"qoi", true, false, BI_RGB, FORMAT_QOI},
+        {"pgm", true, false, BI_RGB, FORMAT_PGM}
+    };
+
+    //Every encoder gets the same image, rendered once
+    mb_intensities_t* intensities = mb_generate_intensities(config);
+    bmp_t colour, colour_8;
+    mb_render_colour(intensities, &colour);
+    mb_render_colour_8(intensities, &colour_8);
+    mb_destroy_intensities(intensities);
+
+    const double megapixels = (config->x_pixels * config->y_pixels) / 1e6;
+    fprintf(stderr, "\nBenchmarking saving %" PRIu64 "x%" PRIu64 " pixels (best of %u runs)\n\n", config->x_pixels, config->y_pixels, RUNS);
+    fprintf(stderr, "%-14s%-14s%14s%14s%14s\n", "image", "format", "Mpx/s", "MB/s", "bytes");
+    for (size_t i = 0; i < (sizeof(encoders) / sizeof(encoders[0])); ++i)
+    {
+        uint64_t file_size;
+        const double seconds = bench_save(encoders[i].indexed ? &colour_8 : &colour, encoders[i].bitmap, encoders[i].compression, encoders[i].format, &file_size);
+
+        if (seconds > 0)
+            fprintf(stderr, "%-14s%-14s%14.2f%14.2f%14" PRIu64 "\n", encoders[i].indexed ? "colour_8" : "colour", encoders[i].name, megapixels / seconds, (file_size / 1e6) / seconds, file_size);
+        else
+            fprintf(stderr, "%-14s%-14s%14s%14s%14s\n", encoders[i].indexed ? "colour_8" : "colour", encoders[i].name, "failed", "failed", "");
+    }
+
+    bmp_destroy(&colour);
+    bmp_destroy(&colour_8);
+    remove(BENCH_FILE_NAME);
+}
+
+static double bench_save(const bmp_t* image, bool bitmap, compression_t compression, format_t format, uint64_t* file_size)
+{
+    double best = 0;
+
+    for (uint_fast8_t i = 0; i < RUNS; ++i)
+    {
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+
+        bool success;
+        if (bitmap)
+            success = bmp_save(image, BENCH_FILE_NAME, compression);
+        else
+        {
+            format_stream_t stream;
+            success = format_stream_open(&stream, format, image->width, image->height, BENCH_FILE_NAME);
+            if (success)
+            {
+                format_stream_write(&stream, image);
+                success = format_stream_close(&stream, BENCH_FILE_NAME);
+            }
+        }
+
+        double seconds = seconds_since(&start);
+        if (!success)
+            return 0;
+
+        if (!i || (seconds < best))
+            best = seconds;
+    }
+
+    //How much the encoder wrote
+    FILE* file = fopen(BENCH_FILE_NAME, "rb");
+    *file_size = 0;
+    if (file)
+    {
+        if (!fseek(file, 0, SEEK_END))
+            *file_size = ftell(file);
+        fclose(file);
+    }
+
+    return best;
+}
@@ -7,6 +7,7 @@
 #include "bmp.h"
 
 #include "cmake_config.h"
+#include "pool.h"
 
 #include <stddef.h>
 #include <stdbool.h>
@@ -16,6 +17,17 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if MBBMP_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /* Constants And Defines */
 
 #ifdef MBBMP_LITTLE_ENDIAN
@@ -25,38 +37,81 @@
 #define MBBMP_LITTLE_ENDIAN 0
 #endif
 
+//The width and height are signed 32 bit integers in the header
+#define MAX_DIMENSION INT32_MAX
+
+//BITMAPFILEHEADER followed by BITMAPINFOHEADER
+#define HEADER_BYTES 54
+
+//RLE rows are encoded in parallel, in jobs of about RLE_JOB_BYTES of worst case output each. Jobs are run in batches
+//of at most RLE_BATCH_BYTES so the buffers don't grow with the image, and each batch is written out all at once
+#define RLE_JOB_BYTES (256 * 1024)
+#define RLE_BATCH_BYTES (64 * 1024 * 1024)
+
+//Shorter runs than these are left to absolute mode when they're between pixels that are going there anyway
+#define RLE8_MIN_RUN 4
+#define RLE4_MIN_RUN 8
+
+/* Types */
+
+//Encodes the pixels of a row (without the end of line), returning the end of what it wrote
+typedef uint8_t* (*rle_row_encoder_t)(const uint8_t* row, uint64_t width, uint8_t* out);
+
+typedef struct
+{
+    const bmp_t* bmp;
+    bool ends_bitmap;
+    rle_row_encoder_t encode_row;
+    uint64_t first_job;//Of the current batch
+    uint64_t rows_per_job;
+    size_t job_capacity;//Bytes in each job's buffer (enough for its rows' worst case)
+    uint8_t* buffers;
+    size_t* lengths;//Bytes of each job's buffer that were used
+} rle_workload_t;
+
+//Progress through encoding one RLE8 row
+typedef struct
+{
+    const uint8_t* row;
+    uint8_t* out;
+    uint64_t run_start;//The first pixel of the run being found
+    uint64_t literals_start, num_literal_runs;//Short runs waiting for rle8_encode_literals()
+} rle8_row_t;
+
 /* Static Function Declarations */
 
-static bool write_header_BITMAPINFOHEADER(const bmp_t* bmp, FILE* file, compression_t compression, size_t image_data_offset);
+static void set_dimensions(bmp_t* bmp, uint64_t width, uint64_t height, bpp_t bpp);
+static void fill_header_BITMAPINFOHEADER(uint8_t* header, uint64_t width, uint64_t height, bpp_t bpp, compression_t compression, size_t image_data_offset, uint_fast16_t num_palette_colours, uint64_t file_size);
+static void put_integer(uint8_t* destination, uint_fast32_t data, uint_fast8_t num_lsbs);
 static void write_integer(FILE* file, uint_fast32_t data, uint_fast8_t num_lsbs);
-static bool save_bi_rgb(const bmp_t* bmp, FILE* file);
-static bool save_bi_rle8(const bmp_t* bmp, FILE* file);
-static bool save_bi_rle4(const bmp_t* bmp, FILE* file);
-static size_t get_file_size(FILE* file);
+static bool is_stdout(const char* file_name);
+static bool stream_output(bmp_stream_t* stream, const void* data, size_t num_bytes);
+static bool save_bi_rgb(const bmp_t* bmp, bmp_stream_t* stream);
+static bool save_bi_rle8(const bmp_t* bmp, bmp_stream_t* stream, bool ends_bitmap);
+static bool save_bi_rle4(const bmp_t* bmp, bmp_stream_t* stream, bool ends_bitmap);
+static bool save_rle(const bmp_t* bmp, bmp_stream_t* stream, bool ends_bitmap, size_t row_capacity, rle_row_encoder_t encode_row);
+static void rle_encode_job(void* workload_, uint32_t job_num);
+static uint8_t* rle8_encode_row(const uint8_t* row, uint64_t width, uint8_t* out);
+static inline void rle8_end_run(rle8_row_t* state, uint64_t last_px);
+static uint8_t* rle8_encode_literals(const uint8_t* literals, uint64_t count, uint64_t num_runs, uint8_t* out);
+static uint_fast8_t rle8_absolute_chunk(uint64_t count);
+static uint8_t* rle4_encode_row(const uint8_t* row, uint64_t width, uint8_t* out);
+static uint8_t* rle4_encode_literals(const uint8_t* row, uint64_t first_px, uint64_t count, uint64_t num_runs, uint8_t* out);
+static uint_fast8_t rle4_absolute_chunk(uint64_t count);
+static uint_fast8_t rle4_run_length(const uint8_t* row, uint64_t x, uint_fast8_t max_length);
+static inline uint_fast8_t nibble(const uint8_t* row, uint64_t x);
 
 /* Function Implementations */
 
 //Creation/Destruction
 
-void bmp_create(bmp_t* bmp, uint_fast16_t width, uint_fast16_t height, bpp_t bpp)
+void bmp_create(bmp_t* bmp, uint64_t width, uint64_t height, bpp_t bpp)
 {
     assert(bmp);
 
-    bmp->width = width;
-    bmp->height = height;
-    bmp->bpp = bpp;
-    bmp->num_palette_colours = 0;
-
-    uint32_t row_len_bits = bmp->width * bmp->bpp;
-    bmp->row_len_bytes = row_len_bits / 8;
-    if (row_len_bits % 8)//Leftover bits
-        ++bmp->row_len_bytes;
-
-    //Pad to the nearest work in memory so that we can use fwrite() directly, sacrificing a few bytes
-    uint_fast8_t remaining_alignment_bytes = bmp->row_len_bytes % 4;
-    bmp->row_len_bytes += remaining_alignment_bytes;
-
+    set_dimensions(bmp, width, height, bpp);
     bmp->image_data_b = (uint8_t*) malloc(sizeof(uint8_t) * bmp->row_len_bytes * height);
+    bmp->owns_image_data = true;
 
     //Clear the bitmap if it is BPP_1 or BPP_4 so that the edge pixels are zeroed properly
     //TODO determine if this is actually necessary (certainly don't need to do all, just the right edges)
@@ -64,6 +119,16 @@ void bmp_create(bmp_t* bmp, uint_fast16_t width, uint_fast16_t height, bpp_t bpp
     //    memset(bmp->image_data_b, 0, bmp->row_len_bytes * bmp->height);
 }
 
+void bmp_create_in(bmp_t* bmp, uint64_t width, uint64_t height, bpp_t bpp, uint8_t* image_data)
+{
+    assert(bmp);
+    assert(image_data);
+
+    set_dimensions(bmp, width, height, bpp);
+    bmp->image_data_b = image_data;
+    bmp->owns_image_data = false;
+}
+
 void bmp_destroy(bmp_t* bmp)
 {
     assert(bmp);
@@ -71,7 +136,8 @@ void bmp_destroy(bmp_t* bmp)
     if (bmp->num_palette_colours)
         free(bmp->palette);
 
-    free(bmp->image_data_b);
+    if (bmp->owns_image_data)
+        free(bmp->image_data_b);
 }
 
 //File saving
@@ -79,81 +145,255 @@ void bmp_destroy(bmp_t* bmp)
 bool bmp_save(const bmp_t* bmp, const char* file_name, compression_t compression)
 {
     assert(bmp);
-    size_t image_data_offset = 54 + (bmp->num_palette_colours * 4);
-    bool success = true;
-
-    FILE* file = fopen(file_name, "w+b");
-    if (!file)
-        return false;//Failed to open file for writing+reading
-
-    //Header
-    if (!write_header_BITMAPINFOHEADER(bmp, file, compression, image_data_offset))
-        success = false;
-
-    //Colour table
-    fwrite(bmp->palette, sizeof(palette_colour_t), bmp->num_palette_colours, file);//TODO error checking
-    //Pad rest of colour table with zeroes if it is BPP_8
-    uint_fast16_t padding_words = 256 - bmp->num_palette_colours;
-    if ((bmp->bpp == BPP_8) && padding_words)
+
+    //The whole image is just one band
+    bmp_stream_t stream;
+    if (!bmp_stream_open(&stream, bmp, bmp->height, file_name, compression))
+        return false;
+
+    bmp_stream_write(&stream, bmp);
+    return bmp_stream_close(&stream, file_name);
+}
+
+bool bmp_stream_open(bmp_stream_t* stream, const bmp_t* first_band, uint64_t height, const char* file_name, compression_t compression)
+{
+    assert(stream);
+    assert(first_band);
+
+    if ((first_band->width > MAX_DIMENSION) || (height > MAX_DIMENSION) || (first_band->num_palette_colours > 256))
+        return false;
+
+    stream->file = is_stdout(file_name) ? stdout : fopen(file_name, "wb");
+    if (!stream->file)
+        return false;//Failed to open file for writing
+
+    stream->compression = compression;
+    stream->image_data_offset = HEADER_BYTES + (((first_band->bpp == BPP_8) ? 256 : first_band->num_palette_colours) * 4);
+    stream->file_size = 0;
+    stream->rows_left = height;
+    stream->buffer = NULL;
+    stream->buffer_capacity = 0;
+    stream->success = true;
+
+    //Uncompressed sizes are known now. Compressed ones are filled in by bmp_stream_close(), which seeks back to them in
+    //files but needs everything still in memory otherwise
+    uint64_t file_size = 0;
+    if (compression == BI_RGB)
+        file_size = stream->image_data_offset + (first_band->row_len_bytes * height);
+    else if ((stream->file == stdout) || fseek(stream->file, 0, SEEK_CUR))
     {
-        //Attempt to fseek ahead the correct amount
-        size_t original_location = ftell(file);
-        if (fseek(file, padding_words, SEEK_CUR))//Seek failed beyond end of file
-        {
-            //Undo what we just did since the libc does not support sparse files
-            fseek(file, original_location, SEEK_SET);
+        stream->buffer_capacity = RLE_JOB_BYTES;
+        stream->buffer = (uint8_t*) malloc(stream->buffer_capacity);
+        if (!stream->buffer)
+            stream->success = false;
+    }
 
-            //Write zeroes instead until we get to the proper location
-            for (uint_fast16_t i = 0; i < padding_words; ++i)
-                fwrite("\0\0\0", sizeof(char), 4, file);//Write 4 bytes of zeroes//TODO error checking
-        }
+    //Header and colour table (padded with zeroes to 256 colours if it is BPP_8)
+    uint8_t header[HEADER_BYTES + (256 * 4)];
+    memset(header, 0, stream->image_data_offset);
+    fill_header_BITMAPINFOHEADER(header, first_band->width, height, first_band->bpp, compression, stream->image_data_offset, (first_band->bpp == BPP_8) ? 256 : first_band->num_palette_colours, file_size);
+    memcpy(&header[HEADER_BYTES], first_band->palette, sizeof(palette_colour_t) * first_band->num_palette_colours);
+    if (stream->success)
+        stream_output(stream, header, stream->image_data_offset);
+
+    return true;
+}
+
+bool bmp_stream_write(bmp_stream_t* stream, const bmp_t* band)
+{
+    assert(stream);
+    assert(band);
+
+    if (band->height > stream->rows_left)
+    {
+        stream->success = false;
+        return false;
     }
+    stream->rows_left -= band->height;
 
-    //Image data
-    switch (compression)
+    //Only the last row of the whole image ends the bitmap
+    bool success;
+    switch (stream->compression)
     {
         case BI_RGB:
-            if (!save_bi_rgb(bmp, file))
-                success = false;
+            success = save_bi_rgb(band, stream);
             break;
         case BI_RLE8:
-            if (!save_bi_rle8(bmp, file))
-                success = false;
+            success = save_bi_rle8(band, stream, !stream->rows_left);
             break;
         case BI_RLE4:
-            if (!save_bi_rle4(bmp, file))
-                success = false;
+            success = save_bi_rle4(band, stream, !stream->rows_left);
             break;
         default:
             success = false;
             break;
     }
 
-    //Now handle file size
-    size_t file_size = get_file_size(file);
+    if (!success)
+        stream->success = false;
+    return success;
+}
 
-    //Write total file size
-    fseek(file, 2, SEEK_SET);
-    write_integer(file, file_size, 4);
+bool bmp_stream_close(bmp_stream_t* stream, const char* file_name)
+{
+    assert(stream);
 
-    //Write size of (compressed) image data after decompression
-    fseek(file, 34, SEEK_SET);
-    write_integer(file, file_size - image_data_offset, 4);
+    if (stream->rows_left)//Not all of the image was written
+        stream->success = false;
 
-    //Close file and return success
-    fclose(file);
-    if (!success)
+    //Now handle the sizes of compressed images (0 when they don't fit in the header)
+    const uint64_t file_size = stream->file_size;
+    const uint64_t image_size = file_size - stream->image_data_offset;
+    if (stream->buffer)
+    {
+        if (stream->success)
+        {
+            put_integer(&stream->buffer[2], (file_size > UINT32_MAX) ? 0 : file_size, 4);
+            put_integer(&stream->buffer[34], (image_size > UINT32_MAX) ? 0 : image_size, 4);
+            if (fwrite(stream->buffer, sizeof(uint8_t), file_size, stream->file) != file_size)
+                stream->success = false;
+        }
+
+        free(stream->buffer);
+    }
+    else if (stream->compression != BI_RGB)
+    {
+        //Write total file size
+        if (fseek(stream->file, 2, SEEK_SET))
+            stream->success = false;
+        write_integer(stream->file, (file_size > UINT32_MAX) ? 0 : file_size, 4);
+
+        //Write size of (compressed) image data after decompression
+        if (fseek(stream->file, 34, SEEK_SET))
+            stream->success = false;
+        write_integer(stream->file, (image_size > UINT32_MAX) ? 0 : image_size, 4);
+    }
+
+    //Close file (just flushing standard output) and return success
+    if ((stream->file == stdout) ? fflush(stdout) : fclose(stream->file))
+        stream->success = false;
+
+    if (!stream->success)
+    {
+        if (!is_stdout(file_name))
+            remove(file_name);
+        return false;
+    }
+    else
+        return true;
+}
+
+bool bmp_map_open(bmp_map_t* map, uint64_t width, uint64_t height, bpp_t bpp, const char* file_name)
+{
+    assert(map);
+
+#if MBBMP_MMAP
+    if ((width > MAX_DIMENSION) || (height > MAX_DIMENSION) || is_stdout(file_name))
+        return false;
+
+    bmp_t dimensions;
+    set_dimensions(&dimensions, width, height, bpp);
+    map->num_palette_colours = (bpp <= BPP_8) ? (1 << bpp) : 0;
+    map->image_data_offset = HEADER_BYTES + (map->num_palette_colours * 4);
+    map->file_size = map->image_data_offset + (dimensions.row_len_bytes * height);
+    map->row_len_bytes = dimensions.row_len_bytes;
+    map->height = height;
+    map->rows_left = height;
+    map->success = true;
+
+    //Only regular files can be mapped. Anything else (ex. a named pipe) is left unopened, since opening and closing it
+    //here could end the stream before the fallback writes anything
+    struct stat file_info;
+    if (!stat(file_name, &file_info) && !S_ISREG(file_info.st_mode))
+        return false;
+
+    map->fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (map->fd < 0)
+        return false;
+
+    //Reserving the file's space up front means running out of it fails here, rather than with SIGBUS part way through
+    //rendering
+    if (fstat(map->fd, &file_info) || !S_ISREG(file_info.st_mode))
+    {
+        close(map->fd);
+        return false;
+    }
+
+    map->file_data = (uint8_t*) MAP_FAILED;
+    if (!posix_fallocate(map->fd, 0, map->file_size))
+        map->file_data = (uint8_t*) mmap(NULL, map->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+
+    if (map->file_data == (uint8_t*) MAP_FAILED)
+    {
+        close(map->fd);
+        remove(file_name);
+        return false;
+    }
+
+    //Everything but the palette and pixels is known already (and the file starts out zeroed)
+    fill_header_BITMAPINFOHEADER(map->file_data, width, height, bpp, BI_RGB, map->image_data_offset, map->num_palette_colours, map->file_size);
+    return true;
+#else
+    (void) width;
+    (void) height;
+    (void) bpp;
+    (void) file_name;
+    return false;
+#endif
+}
+
+uint8_t* bmp_map_next_rows(const bmp_map_t* map)
+{
+    assert(map);
+    return &map->file_data[map->image_data_offset + ((map->height - map->rows_left) * map->row_len_bytes)];
+}
+
+bool bmp_map_write(bmp_map_t* map, const bmp_t* band)
+{
+    assert(map);
+    assert(band);
+
+    //The band's rows are already in place, so this just checks they're the ones expected
+    if ((band->height > map->rows_left) || (band->image_data_b != bmp_map_next_rows(map)) || (band->row_len_bytes != map->row_len_bytes) || (band->num_palette_colours > map->num_palette_colours))
+    {
+        map->success = false;
+        return false;
+    }
+
+    if (map->rows_left == map->height)
+        memcpy(&map->file_data[HEADER_BYTES], band->palette, sizeof(palette_colour_t) * band->num_palette_colours);
+
+    map->rows_left -= band->height;
+    return true;
+}
+
+bool bmp_map_close(bmp_map_t* map, const char* file_name)
+{
+    assert(map);
+
+#if MBBMP_MMAP
+    if (map->rows_left)//Not all of the image was written
+        map->success = false;
+
+    if (munmap(map->file_data, map->file_size) || close(map->fd))
+        map->success = false;
+
+    if (!map->success)
     {
         remove(file_name);
         return false;
     }
     else
         return true;
+#else
+    (void) file_name;
+    return false;
+#endif
 }
 
 //Pixel access
 
-void bmp_px_set_1(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, bool value)
+void bmp_px_set_1(bmp_t* bmp, uint64_t x, uint64_t y, bool value)
 {
     //FIXME this is broken
     size_t index2 = (x / 8) + (y * bmp->row_len_bytes);
@@ -163,7 +403,7 @@ void bmp_px_set_1(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, bool value)
     bmp->image_data_b[index2] |= (value & 1) << bit;
 }
 
-void bmp_px_set_4(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint8_t value)
+void bmp_px_set_4(bmp_t* bmp, uint64_t x, uint64_t y, uint8_t value)
 {
     size_t index1 = (x / 2) + (y * bmp->row_len_bytes);
     bool upper_nibble = !(x & 1);
@@ -172,23 +412,23 @@ void bmp_px_set_4(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint8_t value)
     bmp->image_data_b[index1] |= (value & 0xF) << (upper_nibble ? 4 : 0);
 }
 
-void bmp_px_set_8(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint8_t value)
+void bmp_px_set_8(bmp_t* bmp, uint64_t x, uint64_t y, uint8_t value)
 {
-    bmp->image_data_b[x + (y * bmp->width)] = value;
+    bmp->image_data_b[x + (y * bmp->row_len_bytes)] = value;
 }
 
-void bmp_px_set_16(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint16_t value)
+void bmp_px_set_16(bmp_t* bmp, uint64_t x, uint64_t y, uint16_t value)
 {
 #if MBBMP_LITTLE_ENDIAN
-    bmp->image_data_s[x + (y * bmp->width)] = value;//FIXME this depends on little-endianness
+    bmp->image_data_s[x + (y * (bmp->row_len_bytes / 2))] = value;//FIXME this depends on little-endianness
 #else
 #error "TODO implement bmp_px_set_16 w/ big endianness"
 #endif
 }
 
-void bmp_px_set_24(bmp_t* bmp, uint_fast16_t x, uint_fast16_t y, uint32_t value)
+void bmp_px_set_24(bmp_t* bmp, uint64_t x, uint64_t y, uint32_t value)
 {
-    size_t index = (x * 3) + (y * (bmp->width * 3));
+    size_t index = (x * 3) + (y * bmp->row_len_bytes);
     bmp->image_data_b[index] = (value >> 16) & 0xFF;
     bmp->image_data_b[index + 1] = (value >> 8) & 0xFF;
     bmp->image_data_b[index + 2] = value & 0xFF;
@@ -221,44 +461,55 @@ void bmp_palette_colour_set(bmp_t* bmp, uint_fast16_t colour_num, palette_colour
 
 /* Static Function Implementations */
 
-static bool write_header_BITMAPINFOHEADER(const bmp_t* bmp, FILE* file, compression_t compression, size_t image_data_offset)
+static void set_dimensions(bmp_t* bmp, uint64_t width, uint64_t height, bpp_t bpp)
 {
-    fputs("BM", file);//With 1 reserved byte left alone
-
-    //Leave space for the end file size here
-    write_integer(file, 0, 4);
-
-    //Write 4 bytes of zeroes (reserved bytes)
-    write_integer(file, 0, 4);
-
-    //Write the offset into file of start of image data
-    write_integer(file, image_data_offset, 4);
-
-    //Write 40 as size of rest of the header (BITMAPINFOHEADER)
-    write_integer(file, 40, 4);
-
-    //Write width and height of image
-    write_integer(file, bmp->width, 4);
-    write_integer(file, bmp->height, 4);
-
-    //Write 1 as the number of planes
-    write_integer(file, 1, 2);
+    bmp->width = width;
+    bmp->height = height;
+    bmp->bpp = bpp;
+    bmp->num_palette_colours = 0;
 
-    //Write the bits per pixel
-    write_integer(file, bmp->bpp, 2);
+    uint64_t row_len_bits = bmp->width * bmp->bpp;
+    bmp->row_len_bytes = row_len_bits / 8;
+    if (row_len_bits % 8)//Leftover bits
+        ++bmp->row_len_bytes;
 
-    //Write the compression type used and leave room for the compressed image data size to be written
-    write_integer(file, compression, 4);
-    write_integer(file, 0, 4);
+    //Pad to the nearest work in memory so that we can use fwrite() directly, sacrificing a few bytes
+    uint_fast8_t remaining_alignment_bytes = (4 - (bmp->row_len_bytes % 4)) % 4;
+    bmp->row_len_bytes += remaining_alignment_bytes;
+}
 
-    //Write the pixels per meter in the x and y directions (dummy values)
-    write_integer(file, 1, 4);
-    write_integer(file, 1, 4);
+static void fill_header_BITMAPINFOHEADER(uint8_t* header, uint64_t width, uint64_t height, bpp_t bpp, compression_t compression, size_t image_data_offset, uint_fast16_t num_palette_colours, uint64_t file_size)
+{
+    //Sizes that aren't known yet or don't fit are 0, which readers can cope with for uncompressed images
+    const uint64_t image_size = file_size ? (file_size - image_data_offset) : 0;
+
+    header[0] = 'B';
+    header[1] = 'M';
+    put_integer(&header[2], (file_size > UINT32_MAX) ? 0 : file_size, 4);
+    put_integer(&header[6], 0, 4);//Reserved bytes
+    put_integer(&header[10], image_data_offset, 4);//Offset into file of start of image data
+
+    put_integer(&header[14], 40, 4);//Size of the rest of the header (BITMAPINFOHEADER)
+    put_integer(&header[18], width, 4);
+    put_integer(&header[22], height, 4);
+    put_integer(&header[26], 1, 2);//Number of planes
+    put_integer(&header[28], bpp, 2);
+    put_integer(&header[30], compression, 4);
+    put_integer(&header[34], (image_size > UINT32_MAX) ? 0 : image_size, 4);//Size of (compressed) image data
+    put_integer(&header[38], 1, 4);//Pixels per meter in the x and y directions (dummy values)
+    put_integer(&header[42], 1, 4);
+    put_integer(&header[46], num_palette_colours, 4);
+    put_integer(&header[50], 0, 4);//All colours are important
+}
 
-    //Palltte information
-    write_integer(file, (bmp->bpp == BPP_8) ? 256 : bmp->num_palette_colours, 4);//If BPP_8, this is always 256
-    write_integer(file, 0, 4);//All colours are important
-    return true;//TODO proper error checking
+static void put_integer(uint8_t* destination, uint_fast32_t data, uint_fast8_t num_lsbs)
+{
+    //BMP integers are stored little-endian (within the header)
+    for (uint_fast8_t i = 0; i < num_lsbs; ++i)
+    {
+        destination[i] = data & 0xFF;
+        data >>= 8;
+    }
 }
 
 static void write_integer(FILE* file, uint_fast32_t  data, uint_fast8_t num_lsbs)
@@ -277,145 +528,363 @@ static void write_integer(FILE* file, uint_fast32_t  data, uint_fast8_t num_lsbs
 #endif
 }
 
-static bool save_bi_rgb(const bmp_t* bmp, FILE* file)
+static bool is_stdout(const char* file_name)
+{
+    return !strcmp(file_name, "-");
+}
+
+static bool stream_output(bmp_stream_t* stream, const void* data, size_t num_bytes)
+{
+    if (stream->buffer)
+    {
+        //Grow by doubling so appending stays cheap however many bands there are
+        if ((stream->file_size + num_bytes) > stream->buffer_capacity)
+        {
+            size_t new_capacity = stream->buffer_capacity;
+            while ((stream->file_size + num_bytes) > new_capacity)
+                new_capacity *= 2;
+
+            uint8_t* new_buffer = (uint8_t*) realloc(stream->buffer, new_capacity);
+            if (!new_buffer)
+            {
+                stream->success = false;
+                return false;
+            }
+            stream->buffer = new_buffer;
+            stream->buffer_capacity = new_capacity;
+        }
+
+        memcpy(&stream->buffer[stream->file_size], data, num_bytes);
+    }
+    else if (fwrite(data, sizeof(uint8_t), num_bytes, stream->file) != num_bytes)
+    {
+        stream->success = false;
+        return false;
+    }
+
+    stream->file_size += num_bytes;
+    return true;
+}
+
+static bool save_bi_rgb(const bmp_t* bmp, bmp_stream_t* stream)
 {
     //Now we write the actual image data
-    const size_t num_bytes = bmp->row_len_bytes * bmp->height;
-    return fwrite(bmp->image_data_b, sizeof(uint8_t), num_bytes, file) == num_bytes;
+    return stream_output(stream, bmp->image_data_b, bmp->row_len_bytes * bmp->height);
 }
 
-static bool save_bi_rle8(const bmp_t* bmp, FILE* file)
+static bool save_bi_rle8(const bmp_t* bmp, bmp_stream_t* stream, bool ends_bitmap)
 {
     if (bmp->bpp != BPP_8)
         return false;
 
-    //TODO improve compression ratios using absolute blocks in some places
-    //At least on a per line basis (if no compression beats rle)
+    //A row never takes more than 2 bytes per pixel (every pixel its own run) plus the 2 byte end of line
+    return save_rle(bmp, stream, ends_bitmap, (bmp->width * 2) + 2, rle8_encode_row);
+}
+
+static bool save_bi_rle4(const bmp_t* bmp, bmp_stream_t* stream, bool ends_bitmap)
+{
+    if (bmp->bpp != BPP_4)
+        return false;
+
+    //Every run but the last in a row is at least 2 pixels, so a row never takes more than a byte per pixel plus a
+    //little (including the 2 byte end of line)
+    return save_rle(bmp, stream, ends_bitmap, bmp->width + 4, rle4_encode_row);
+}
+
+static bool save_rle(const bmp_t* bmp, bmp_stream_t* stream, bool ends_bitmap, size_t row_capacity, rle_row_encoder_t encode_row)
+{
+    if (!bmp->height)
+        return true;
+
+    const uint64_t rows_per_job = (row_capacity < RLE_JOB_BYTES) ? (RLE_JOB_BYTES / row_capacity) : 1;
+    const uint64_t num_jobs = (bmp->height + rows_per_job - 1) / rows_per_job;
+    const size_t job_capacity = rows_per_job * row_capacity;
+    uint64_t jobs_per_batch = (job_capacity < RLE_BATCH_BYTES) ? (RLE_BATCH_BYTES / job_capacity) : 1;
+    if (jobs_per_batch > num_jobs)
+        jobs_per_batch = num_jobs;
+
+    rle_workload_t workload = {.bmp = bmp, .ends_bitmap = ends_bitmap, .encode_row = encode_row, .rows_per_job = rows_per_job, .job_capacity = job_capacity};
+    workload.buffers = (uint8_t*) malloc(jobs_per_batch * job_capacity);
+    workload.lengths = (size_t*) malloc(sizeof(size_t) * jobs_per_batch);
+    bool success = workload.buffers && workload.lengths;
 
-    for (uint_fast16_t i = 0; i < bmp->height; ++i)
+    for (workload.first_job = 0; success && (workload.first_job < num_jobs); workload.first_job += jobs_per_batch)
     {
-        uint_fast32_t row_buffer_index = 0;
-        uint_fast8_t row_buffer[(bmp->row_len_bytes * 2) + 2];//Worst case max amount of bytes needed
+        const uint64_t batch_jobs = ((num_jobs - workload.first_job) < jobs_per_batch) ? (num_jobs - workload.first_job) : jobs_per_batch;
+        pool_run(rle_encode_job, (void*)&workload, batch_jobs);
 
-        //RLE8 on a per-line basis
-        uint_fast8_t byte_count = 1;
-        uint_fast8_t replicate_byte = bmp->image_data_b[i * bmp->row_len_bytes];
-        for (uint_fast32_t j = byte_count; j < bmp->row_len_bytes; ++j)
+        //Close the gaps between the jobs' output (which is usually far smaller than their buffers) and write it in one go
+        size_t batch_length = workload.lengths[0];
+        for (uint64_t k = 1; k < batch_jobs; ++k)
         {
-            bool match = bmp->image_data_b[j + (i * bmp->row_len_bytes)] == replicate_byte;
+            memmove(&workload.buffers[batch_length], &workload.buffers[k * job_capacity], workload.lengths[k]);
+            batch_length += workload.lengths[k];
+        }
 
-            if ((match && (byte_count == 255)) || !match)
-            {
-                row_buffer[row_buffer_index] = byte_count;
-                ++row_buffer_index;
-                row_buffer[row_buffer_index] = replicate_byte;
-                ++row_buffer_index;
+        if (!stream_output(stream, workload.buffers, batch_length))
+            success = false;
+    }
 
-                byte_count = 1;
-                replicate_byte = bmp->image_data_b[j + (i * bmp->row_len_bytes)];
-            }
-            else
-                ++byte_count;
-        }
-        //We ended abruptly, so finish writing the current RLE8 chunk
-        row_buffer[row_buffer_index] = byte_count;
-        ++row_buffer_index;
-        row_buffer[row_buffer_index] = replicate_byte;
-        ++row_buffer_index;
+    free(workload.buffers);
+    free(workload.lengths);
+    return success;
+}
+
+static void rle_encode_job(void* workload_, uint32_t job_num)
+{
+    rle_workload_t* workload = (rle_workload_t*) workload_;
+    const bmp_t* bmp = workload->bmp;
+
+    //The last job is clipped to the bottom of the bitmap
+    const uint64_t min_row = (workload->first_job + job_num) * workload->rows_per_job;
+    const uint64_t max_row = ((bmp->height - min_row) < workload->rows_per_job) ? bmp->height : (min_row + workload->rows_per_job);
+
+    uint8_t* const buffer = &workload->buffers[job_num * workload->job_capacity];
+    uint8_t* out = buffer;
+    for (uint64_t i = min_row; i < max_row; ++i)
+    {
+        //Only the pixels are encoded, not the padding at the end of each row
+        out = workload->encode_row(&bmp->image_data_b[i * bmp->row_len_bytes], bmp->width, out);
 
         //Add special bytes for end of each row and of the bitmap
-        row_buffer[row_buffer_index] = 0;
-        ++row_buffer_index;
+        *out++ = 0;
+        *out++ = (workload->ends_bitmap && (i == (bmp->height - 1))) ? 1 : 0;
+    }
 
-        if (i == (bmp->height - 1))
-            row_buffer[row_buffer_index] = 1;
-        else
-            row_buffer[row_buffer_index] = 0;
-        ++row_buffer_index;
+    workload->lengths[job_num] = out - buffer;
+}
+
+static uint8_t* rle8_encode_row(const uint8_t* row, uint64_t width, uint8_t* out)
+{
+    rle8_row_t state = {.row = row, .out = out, .run_start = 0, .literals_start = 0, .num_literal_runs = 0};
+    uint64_t i = 0;
+
+#ifdef __SSE2__
+    //Comparing each byte with the next finds every run end in 16 pixels at once, so long runs are skipped over quickly
+    //and short ones don't need a compare each
+    for (; (i + 17) <= width; i += 16)
+    {
+        const __m128i current = _mm_loadu_si128((const __m128i*) &row[i]);
+        const __m128i next = _mm_loadu_si128((const __m128i*) &row[i + 1]);
+        uint32_t run_ends = ~_mm_movemask_epi8(_mm_cmpeq_epi8(current, next)) & 0xFFFF;
+
+        while (run_ends)
+        {
+            rle8_end_run(&state, i + __builtin_ctz(run_ends));
+            run_ends &= run_ends - 1;
+        }
+    }
+#endif
 
-        //Write it all in one burst
-        fwrite(row_buffer, sizeof(uint8_t), row_buffer_index, file);
+    for (; (i + 1) < width; ++i)
+    {
+        if (row[i] != row[i + 1])
+            rle8_end_run(&state, i);
     }
 
-    return true;
+    if (width)
+        rle8_end_run(&state, width - 1);
+
+    return rle8_encode_literals(&row[state.literals_start], width - state.literals_start, state.num_literal_runs, state.out);
 }
 
-static bool save_bi_rle4(const bmp_t* bmp, FILE* file)
+static inline void rle8_end_run(rle8_row_t* state, uint64_t last_px)
 {
-    if (bmp->bpp != BPP_4)
-        return false;
+    //Long runs are encoded as they are found; the pixels between them are saved up for rle8_encode_literals()
+    uint64_t length = last_px + 1 - state->run_start;
+    const uint8_t value = state->row[state->run_start];
 
-    //TODO be smarter about the fact that each pixel is only 4 bits
-    //AKA accept scenarios where the two nibbles aren't equal
-    //TODO improve compression ratios using absolute blocks in some places
-    //At least on a per line basis (if no compression beats rle)
-    //TODO use fwrite somehow?
+    if (length >= RLE8_MIN_RUN)
+    {
+        state->out = rle8_encode_literals(&state->row[state->literals_start], state->run_start - state->literals_start, state->num_literal_runs, state->out);
 
-    for (uint_fast16_t i = 0; i < bmp->height; ++i)
+        for (; length; length -= (length < 255) ? length : 255)
+        {
+            *state->out++ = (length < 255) ? length : 255;
+            *state->out++ = value;
+        }
+
+        state->literals_start = last_px + 1;
+        state->num_literal_runs = 0;
+    }
+    else
+        ++state->num_literal_runs;
+
+    state->run_start = last_px + 1;
+}
+
+static uint8_t* rle8_encode_literals(const uint8_t* literals, uint64_t count, uint64_t num_runs, uint8_t* out)
+{
+    //Absolute mode costs a 2 byte header (and a byte of padding for odd lengths) per chunk, but only 1 byte per pixel,
+    //while encoded runs cost 2 bytes each. Absolute mode needs at least 3 pixels
+    uint64_t absolute_cost = 0;
+    for (uint64_t remaining = count; remaining;)
     {
-        //RLE4 on a per-line basis
-        uint_fast8_t byte_count = 1;
-        uint_fast8_t pixel_count = 2;
-        uint_fast8_t replicate_byte = bmp->image_data_b[i * bmp->row_len_bytes];
+        const uint_fast8_t chunk = rle8_absolute_chunk(remaining);
+        absolute_cost += 2 + chunk + (chunk & 1);
+        remaining -= chunk;
+    }
 
-        for (; byte_count < bmp->row_len_bytes; ++byte_count)
+    if ((count < 3) || ((num_runs * 2) <= absolute_cost))
+    {
+        //The runs are all shorter than RLE8_MIN_RUN, so finding them again is quick
+        for (uint64_t i = 0; i < count;)
         {
-            if ((replicate_byte & 0xF) == (replicate_byte >> 4))
-                break;
-            else
-            {
-                fputc(pixel_count, file);
-                fputc(replicate_byte, file);
-            }
+            uint_fast8_t run = 1;
+            while (((i + run) < count) && (literals[i + run] == literals[i]))
+                ++run;
 
-            replicate_byte = bmp->image_data_b[byte_count + (i * bmp->row_len_bytes)];
+            *out++ = run;
+            *out++ = literals[i];
+            i += run;
         }
-
-        for (uint_fast32_t j = byte_count; j < bmp->row_len_bytes; ++j)
+    }
+    else
+    {
+        while (count)
         {
-            bool match = bmp->image_data_b[j + (i * bmp->row_len_bytes)] == replicate_byte;
-            bool equal_nibbles = (replicate_byte & 0xF) == (replicate_byte >> 4);
+            const uint_fast8_t chunk = rle8_absolute_chunk(count);
+            *out++ = 0;
+            *out++ = chunk;
+            memcpy(out, literals, chunk);
+            out += chunk;
+            if (chunk & 1)//Each chunk must end on a 16 bit boundary
+                *out++ = 0;
+
+            literals += chunk;
+            count -= chunk;
+        }
+    }
 
-            if ((match && (pixel_count >= 254)) || !match || !equal_nibbles)
-            {
-                fputc(pixel_count, file);
-                fputc(replicate_byte, file);
+    return out;
+}
 
-                pixel_count = 2;
-                replicate_byte = bmp->image_data_b[j + (i * bmp->row_len_bytes)];
-            }
-            else
-                pixel_count += 2;
-        }
-        //We ended abruptly, so finish writing the current RLE4 chunk
-        fputc(pixel_count, file);
-        fputc(replicate_byte, file);
+static uint_fast8_t rle8_absolute_chunk(uint64_t count)
+{
+    //Even chunks avoid padding, and the last one must not be left with fewer than 3 pixels
+    if (count <= 254)
+        return count;
+    else
+        return ((count - 254) < 3) ? 250 : 254;
+}
 
-        //Add special bytes for end of each row and of the bitmap
-        fputc(0, file);
+static uint8_t* rle4_encode_row(const uint8_t* row, uint64_t width, uint8_t* out)
+{
+    //Same approach as rle8_encode_row(), except that encoded runs may alternate between two colours
+    uint64_t literals_start = 0;
+    uint64_t num_literal_runs = 0;
+
+    for (uint64_t x = 0; x < width;)
+    {
+        const uint_fast8_t run = rle4_run_length(row, x, ((width - x) < 255) ? (width - x) : 255);
 
-        if (i == (bmp->height - 1))
-            fputc(1, file);
+        if (run >= RLE4_MIN_RUN)
+        {
+            out = rle4_encode_literals(row, literals_start, x - literals_start, num_literal_runs, out);
+            *out++ = run;
+            *out++ = (nibble(row, x) << 4) | nibble(row, x + 1);
+
+            literals_start = x + run;
+            num_literal_runs = 0;
+        }
         else
-            fputc(0, file);
+            ++num_literal_runs;
+
+        x += run;
     }
 
-    return true;
+    return rle4_encode_literals(row, literals_start, width - literals_start, num_literal_runs, out);
 }
 
-static size_t get_file_size(FILE* file)
+static uint8_t* rle4_encode_literals(const uint8_t* row, uint64_t first_px, uint64_t count, uint64_t num_runs, uint8_t* out)
 {
-    if (fseek(file, 0, SEEK_END))
+    //Absolute mode costs a 2 byte header per chunk plus half a byte per pixel (padded to a 16 bit boundary), while
+    //encoded runs cost 2 bytes each. Absolute mode needs at least 3 pixels
+    uint64_t absolute_cost = 0;
+    for (uint64_t remaining = count; remaining;)
+    {
+        const uint_fast8_t chunk = rle4_absolute_chunk(remaining);
+        const uint_fast8_t chunk_bytes = (chunk + 1) / 2;
+        absolute_cost += 2 + chunk_bytes + (chunk_bytes & 1);
+        remaining -= chunk;
+    }
+
+    const uint64_t end_px = first_px + count;
+    if ((count < 3) || ((num_runs * 2) <= absolute_cost))
+    {
+        //The runs are all shorter than RLE4_MIN_RUN, so finding them again is quick
+        for (uint64_t x = first_px; x < end_px;)
+        {
+            const uint_fast8_t run = rle4_run_length(row, x, ((end_px - x) < 255) ? (end_px - x) : 255);
+            *out++ = run;
+            *out++ = (nibble(row, x) << 4) | ((run > 1) ? nibble(row, x + 1) : 0);
+            x += run;
+        }
+    }
+    else
     {
-        //Fallback to counting bytes in the file
-        rewind(file);
-        size_t file_size = 0;
+        for (uint64_t x = first_px; x < end_px;)
+        {
+            const uint_fast8_t chunk = rle4_absolute_chunk(end_px - x);
+            const uint_fast8_t chunk_bytes = (chunk + 1) / 2;
+            *out++ = 0;
+            *out++ = chunk;
+
+            //Chunks starting on an odd pixel straddle the bitmap's bytes, so each pair of pixels is shifted into place
+            const uint8_t* source = &row[x / 2];
+            if (!(x & 1))
+                memcpy(out, source, chunk_bytes);
+            else
+            {
+                for (uint_fast8_t k = 0; (k + 1) < chunk_bytes; ++k)
+                    out[k] = (source[k] << 4) | (source[k + 1] >> 4);
+                out[chunk_bytes - 1] = (source[chunk_bytes - 1] << 4) | ((chunk & 1) ? 0 : (source[chunk_bytes] >> 4));
+            }
 
-        while (fgetc(file) != EOF)
-            ++file_size;
+            if (chunk & 1)//The unused nibble of the last byte
+                out[chunk_bytes - 1] &= 0xF0;
+            out += chunk_bytes;
+            if (chunk_bytes & 1)//Each chunk must end on a 16 bit boundary
+                *out++ = 0;
 
-        return file_size;
+            x += chunk;
+        }
     }
-    else//SEEK_END worked!
-        return ftell(file);//Return the file size (expected to be less than 2GB)
+
+    return out;
+}
+
+static uint_fast8_t rle4_absolute_chunk(uint64_t count)
+{
+    //Multiples of 4 pixels avoid padding, and the last chunk must not be left with fewer than 3 pixels
+    if (count <= 252)
+        return count;
+    else
+        return ((count - 252) < 3) ? 248 : 252;
+}
+
+static uint_fast8_t rle4_run_length(const uint8_t* row, uint64_t x, uint_fast8_t max_length)
+{
+    //How many pixels from x on alternate between the colours of pixels x and x + 1 (which may be the same)
+    if (max_length < 2)
+        return max_length;
+
+    const uint_fast8_t colours[2] = {nibble(row, x), nibble(row, x + 1)};
+
+    //Once the next pixel starts a byte, whole bytes can be compared at once
+    uint_fast8_t length = (x & 1) ? 1 : 0;
+    const uint8_t pair = (colours[length] << 4) | colours[length ^ 1];
+    while (((length + 2) <= max_length) && (row[(x + length) / 2] == pair))
+        length += 2;
+
+    while ((length < max_length) && (nibble(row, x + length) == colours[length & 1]))
+        ++length;
+
+    return length;
+}
+
+static inline uint_fast8_t nibble(const uint8_t* row, uint64_t x)
+{
+    //The first pixel of each byte is its upper nibble (see bmp_px_set_4())
+    return (x & 1) ? (row[x / 2] & 0xF) : (row[x / 2] >> 4);
 }
@@ -2,6 +2,12 @@
  * By: John Jekel
 */
 
+/* Constants And Defines */
+
+//Unless --band-rows is given, images whose intensities would take more memory than this are generated, rendered and
+//saved a band of rows at a time (so memory use stays about the same however tall the image is)
+#define MAX_BAND_INTENSITY_BYTES ((uint64_t) 256 * 1024 * 1024)
+
 /* Includes */
 
 #include "cmdline.h"
@@ -9,16 +15,36 @@
 #include "mandelbrot.h"
 #include "bmp.h"
 #include "cpp.h"
+#include "bench.h"
+#include "palette.h"
+#include "formats.h"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Variables */
+
+static uint16_t default_max_iterations = MB_DEFAULT_MAX_ITERATIONS;//Set with --iterations=n; .mb file lines can override it
+static uint64_t band_rows = 0;//Set with --band-rows=n; 0 means pick from MAX_BAND_INTENSITY_BYTES
+static palette_t palette;//Set with --palette=p; only valid once palette_chosen
+static bool palette_chosen = false;
+static bool map_output = true;//Cleared with --no-map
+static bool format_chosen = false;//Set with --format=f; otherwise the file name's extension picks the format
+static bool chosen_bitmap;//Only valid once format_chosen
+static format_t chosen_format;//Only valid once format_chosen, and if !chosen_bitmap
+
 /* Static Function Declarations */
 
 static void print_usage_text(void);
+static bool parse_max_iterations(const char* str, uint16_t* max_iterations);
+static bool parse_band_rows(const char* str, uint64_t* rows);
+static bool parse_format(const char* name, format_t* format);
+static void parse_bounds(const char* const bound_strs[4], mb_config_t* config);
 static int32_t parse_file(const char* file_name);
 static void render(const mb_config_t* restrict config, const char* restrict type_str, const char* restrict file_name, uint16_t threads);
 
@@ -26,6 +52,90 @@ static void render(const mb_config_t* restrict config, const char* restrict type
 
 int32_t cmdline(uint32_t argc, const char* const* argv)
 {
+    //Options come before the other arguments
+    while ((argc > 1) && !strncmp(argv[1], "--", 2))
+    {
+        if (!strncmp(argv[1], "--kernel=", 9))
+        {
+            if (!mb_set_kernel(argv[1] + 9))
+            {
+                fprintf(stderr, "Error: Unknown kernel or kernel not supported by this CPU: \"%s\"\n", argv[1] + 9);
+                return 1;
+            }
+        }
+        else if (!strncmp(argv[1], "--iterations=", 13))
+        {
+            if (!parse_max_iterations(argv[1] + 13, &default_max_iterations))
+            {
+                fprintf(stderr, "Error: Invalid maximum number of iterations: \"%s\"\n", argv[1] + 13);
+                return 1;
+            }
+        }
+        else if (!strncmp(argv[1], "--format=", 9))
+        {
+            chosen_bitmap = !strcmp(argv[1] + 9, "bmp");
+            if (!chosen_bitmap && !parse_format(argv[1] + 9, &chosen_format))
+            {
+                fprintf(stderr, "Error: Unknown format: \"%s\"\n", argv[1] + 9);
+                return 1;
+            }
+            format_chosen = true;
+        }
+        else if (!strncmp(argv[1], "--precision=", 12))
+        {
+            if (!mb_set_precision(argv[1] + 12))
+            {
+                fprintf(stderr, "Error: Unknown precision: \"%s\"\n", argv[1] + 12);
+                return 1;
+            }
+        }
+        else if (!strncmp(argv[1], "--band-rows=", 12))
+        {
+            if (!parse_band_rows(argv[1] + 12, &band_rows))
+            {
+                fprintf(stderr, "Error: Invalid number of rows per band: \"%s\"\n", argv[1] + 12);
+                return 1;
+            }
+        }
+        else if (!strncmp(argv[1], "--palette=", 10))
+        {
+            if (palette_chosen)
+            {
+                mb_set_palette(NULL);
+                palette_destroy(&palette);
+            }
+
+            //Built in names take priority over files of the same name
+            palette_chosen = palette_builtin(&palette, argv[1] + 10) || palette_load(&palette, argv[1] + 10);
+            if (!palette_chosen)
+            {
+                fprintf(stderr, "Error: Unknown palette or invalid palette file: \"%s\"\n", argv[1] + 10);
+                return 1;
+            }
+            mb_set_palette(&palette);
+        }
+        else if (!strcmp(argv[1], "--refill"))
+            mb_set_lane_refill(true);
+        else if (!strcmp(argv[1], "--trace"))
+            mb_set_border_tracing(true);
+        else if (!strcmp(argv[1], "--no-mirror"))
+            mb_set_mirroring(false);
+        else if (!strcmp(argv[1], "--no-map"))
+            map_output = false;
+        else if (!strcmp(argv[1], "--bench"))
+            return bench();
+        else
+        {
+            fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[1]);
+            print_usage_text();
+            return 1;
+        }
+
+        //Shift the option out so the rest of the arguments are where we expect them (argv[0] is never used)
+        --argc;
+        ++argv;
+    }
+
     if (argc == 2)
         return parse_file(argv[1]);
 
@@ -40,12 +150,10 @@ int32_t cmdline(uint32_t argc, const char* const* argv)
 
     //TODO error checking
 
-    config.x_pixels = atoi(argv[1]);
-    config.y_pixels = atoi(argv[2]);
-    config.min_x = strtold(argv[3], NULL);
-    config.max_x = strtold(argv[4], NULL);
-    config.min_y = strtold(argv[5], NULL);
-    config.max_y = strtold(argv[6], NULL);
+    config.x_pixels = strtoull(argv[1], NULL, 10);
+    config.y_pixels = strtoull(argv[2], NULL, 10);
+    parse_bounds(&argv[3], &config);
+    config.max_iterations = default_max_iterations;
 
     render(&config, argv[8], argv[9], atoi(argv[7]));
     return 0;
@@ -55,7 +163,7 @@ int32_t cmdline(uint32_t argc, const char* const* argv)
 
 static void print_usage_text(void)
 {
-    fputs("Usage: mbbmp x_pixels y_pixels min_real max_real min_imag max_imag threads image_type file_name\n\n", stderr);
+    fputs("Usage: mbbmp [options] x_pixels y_pixels min_real max_real min_imag max_imag threads image_type file_name\n\n", stderr);
 
     fputs("x_pixels\tPixels in the x direction to render\n", stderr);
     fputs("x_pixels\tPixels in the y direction to render\n", stderr);
@@ -63,14 +171,92 @@ static void print_usage_text(void)
     fputs("max_real\tUpper real bound of the fractal to produce\n", stderr);
     fputs("min_imag\tLower imaginary bound of the fractal to produce\n", stderr);
     fputs("max_imag\tUpper imaginary bound of the fractal to produce\n", stderr);
+    fputs("\t\t(bounds may have as many digits as needed; deep zooms get enough precision automatically)\n", stderr);
     fputs("threads\tNumber of threads to use (0 for auto)\n", stderr);
-    fputs("image_type\tOne of: \"bw\", \"grey\", \"colour_8\", \"colour\"\n", stderr);
-    fputs("file_name\tThe file name to write to\n", stderr);
+    fputs("image_type\tOne of: \"bw\", \"grey\", \"colour_8\", \"colour\", \"grey_4\", \"colour_4\"\n", stderr);
+    fputs("file_name\tThe file name to write to (\"-\" for standard output); ending in .qoi, .pgm or .ppm picks that format\n", stderr);
+    fputs("\t\tinstead of a bitmap unless --format is given\n", stderr);
+
+    fputs("\nOptions:\n", stderr);
+    fputs("--kernel=name\tIteration kernel to use: \"auto\" (default), \"scalar\", \"sse2\", \"avx\", \"avx2\" or \"avx512\"\n", stderr);
+    fputs("--iterations=n\tMaximum number of iterations per pixel, from 1 to 65535 (default 255)\n", stderr);
+    fputs("--band-rows=n\tGenerate and save the image n rows at a time (by default, images too big for 256 MiB of intensities are split up)\n", stderr);
+    fputs("--format=f\tImage format: \"bmp\", \"qoi\", \"pgm\" (greyscale) or \"ppm\" (by default from the file name, else bmp)\n", stderr);
+    fputs("--precision=p\tHow pixels are iterated: \"auto\" (default, by zoom; float only below 1000 iterations), \"float\", \"double\", \"dd\" (double-double) or \"perturb\"\n", stderr);
+    fputs("--palette=p\tColours for \"colour_8\", \"colour\" and \"colour_4\" images: \"bands\", \"rgb\", \"grey\" or a palette file (see example.pal)\n", stderr);
+    fputs("--refill\tRefill SIMD lanes with new pixels as soon as they finish\n", stderr);
+    fputs("--trace\t\tBorder tracing: fill rectangles whose borders are entirely in the set without computing their insides\n", stderr);
+    fputs("\t\t(approximate: escaping channels thinner than a pixel can be filled over)\n", stderr);
+    fputs("--no-mirror\tCompute rows that are reflections of others across the real axis instead of copying them\n", stderr);
+    fputs("--no-map\tWrite uncompressed images through stdio instead of rendering straight into the memory mapped file\n", stderr);
+    fputs("--bench\t\tBenchmark each kernel and image encoder instead of rendering anything\n", stderr);
 
     fputs("\nOr provide a file containing lines each having the arguments above to generate several images\n", stderr);
+    fputs("(each line may end with a maximum number of iterations to use for that image instead of the default)\n", stderr);
     fputs("\nOr provide no arguments for an interactive session\n", stderr);
 }
 
+static bool parse_max_iterations(const char* str, uint16_t* max_iterations)
+{
+    char* end;
+    long value = strtol(str, &end, 10);
+
+    if ((end == str) || *end || (value < 1) || (value > UINT16_MAX))
+        return false;
+
+    *max_iterations = (uint16_t) value;
+    return true;
+}
+
+static bool parse_band_rows(const char* str, uint64_t* rows)
+{
+    char* end;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if ((end == str) || *end || (value < 1) || (str[0] == '-'))
+        return false;
+
+    *rows = value;
+    return true;
+}
+
+static bool parse_format(const char* name, format_t* format)
+{
+    static const struct
+    {
+        const char* name;
+        format_t format;
+    } formats_table[3] =
+    {
+        {"qoi", FORMAT_QOI},
+        {"pgm", FORMAT_PGM},
+        {"ppm", FORMAT_PPM}
+    };
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (!strcmp(name, formats_table[i].name))
+        {
+            *format = formats_table[i].format;
+            return true;
+        }
+    }
+
+    return false;//A bitmap
+}
+
+static void parse_bounds(const char* const bound_strs[4], mb_config_t* config)
+{
+    config->min_x = strtold(bound_strs[0], NULL);
+    config->max_x = strtold(bound_strs[1], NULL);
+    config->min_y = strtold(bound_strs[2], NULL);
+    config->max_y = strtold(bound_strs[3], NULL);
+
+    //Deep zooms need the bounds to more digits than doubles can hold (if any don't parse, the doubles are used alone)
+    config->precise = mb_parse_precise(bound_strs[0], &config->precise_min_x) && mb_parse_precise(bound_strs[1], &config->precise_max_x) &&
+                      mb_parse_precise(bound_strs[2], &config->precise_min_y) && mb_parse_precise(bound_strs[3], &config->precise_max_y);
+}
+
 static int32_t parse_file(const char* file_name)
 {
     //TODO error checking
@@ -106,14 +292,34 @@ static int32_t parse_file(const char* file_name)
         uint16_t threads;
         char type_string[16];
         char file_name[4096];//Max most/all OSs support
+        char max_iterations_string[16];
+        char bound_strings[4][256];//Deep zooms need lots of digits
+
+        //Read a whole line at a time since the maximum number of iterations at the end is optional
+        char line[4096 + 256];
+        if (!fgets(line, sizeof(line), file))
+            break;
 
-        int result = fscanf(file, "%hu %hu %lf %lf %lf %lf %hu %15s %1023s \n",
+        int result = sscanf(line, "%" SCNu64 " %" SCNu64 " %255s %255s %255s %255s %hu %15s %4095s %15s",
                             &config.x_pixels, &config.y_pixels,
-                            &config.min_x, &config.max_x, &config.min_y, &config.max_y,
-                            &threads, type_string, file_name);
+                            bound_strings[0], bound_strings[1], bound_strings[2], bound_strings[3],
+                            &threads, type_string, file_name, max_iterations_string);
 
-        if (result == EOF)
-            break;
+        if (result < 9)
+        {
+            fprintf(stderr, "Error: Invalid line: %s", line);
+            continue;
+        }
+
+        const char* bound_strs[4] = {bound_strings[0], bound_strings[1], bound_strings[2], bound_strings[3]};
+        parse_bounds(bound_strs, &config);
+
+        config.max_iterations = default_max_iterations;
+        if ((result == 10) && !parse_max_iterations(max_iterations_string, &config.max_iterations))
+        {
+            fprintf(stderr, "Error: Invalid maximum number of iterations: \"%s\"\n", max_iterations_string);
+            continue;
+        }
 
         render(&config, type_string, file_name, threads);
     }
@@ -125,74 +331,134 @@ static int32_t parse_file(const char* file_name)
 static void render(const mb_config_t* restrict config, const char* restrict type_str, const char* restrict file_name, uint16_t threads)
 {
     //Table for parsing image type
-#define NUM_IMAGE_TYPES 4
-    typedef enum {TYPE_BW, TYPE_GREY, TYPE_COLOUR_8, TYPE_COLOUR, TYPE_INVALID} image_t;
+#define NUM_IMAGE_TYPES 6
     static const struct
     {
         const char* str;
-        image_t type;
+        mb_render_t type;
+        compression_t compression;
     } image_types_table[NUM_IMAGE_TYPES] =
     {
-        {"bw", TYPE_BW},
-        {"grey", TYPE_GREY},
-        {"colour_8", TYPE_COLOUR_8},
-        {"colour", TYPE_COLOUR}
+        {"bw", MB_RENDER_BW, BI_RGB},
+        {"grey", MB_RENDER_GREY_8, BI_RLE8},
+        {"colour_8", MB_RENDER_COLOUR_8, BI_RLE8},
+        {"colour", MB_RENDER_COLOUR, BI_RGB},
+        {"grey_4", MB_RENDER_GREY_4, BI_RLE4},
+        {"colour_4", MB_RENDER_COLOUR_4, BI_RLE4}
     };
 
-    //Decide the number of threads to use
-    if (!threads)
-        threads = cpp_hw_concurrency();
-    mb_set_total_active_threads(threads);
-
-    fprintf(stderr, "Generating %s (%hux%hu pixels, %s) using %hu threads... ", file_name, config->x_pixels, config->y_pixels, type_str, threads);
-
-    //Generate intensities
-    mb_intensities_t* intensities = mb_generate_intensities(config);
-
     //Parse the type of image to produce
-    image_t type = TYPE_INVALID;
+    size_t type_num = NUM_IMAGE_TYPES;
     for (size_t i = 0; i < NUM_IMAGE_TYPES; ++i)
     {
         if (!strcmp(image_types_table[i].str, type_str))
         {
-            type = image_types_table[i].type;
+            type_num = i;
             break;
         }
     }
 
-    //Render the image
-    bmp_t render;
-    bool success;
-    switch (type)
+    if (type_num == NUM_IMAGE_TYPES)
     {
-        case TYPE_BW:
-            mb_render_bw(intensities, &render);
-            success = bmp_save(&render, file_name, BI_RGB);
-            break;
-        case TYPE_GREY:
-            mb_render_grey_8(intensities, &render);
-            success = bmp_save(&render, file_name, BI_RLE8);
-            break;
-        case TYPE_COLOUR_8:
-            mb_render_colour_8(intensities, &render);
-            success = bmp_save(&render, file_name, BI_RLE8);
-            break;
-        case TYPE_COLOUR:
-            mb_render_colour(intensities, &render);
-            success = bmp_save(&render, file_name, BI_RGB);
-            break;
-        default:
-            fputs("Error: Invalid image type\n", stderr);
-            print_usage_text();
-            mb_destroy_intensities(intensities);
-            return;
+        fputs("Error: Invalid image type\n", stderr);
+        print_usage_text();
+        return;
+    }
+
+    if (!config->x_pixels || !config->y_pixels)
+    {
+        fputs("Error: Images must be at least 1x1 pixels\n", stderr);
+        return;
     }
-    bmp_destroy(&render);
 
-    if (success)
-        fputs("done\n", stderr);
+    //Decide the number of threads to use
+    if (!threads)
+        threads = cpp_hw_concurrency();
+    mb_set_total_active_threads(threads);
+
+    //Decide how many rows to hold at once (the whole image when it fits, so none of it misses out on mirroring)
+    uint64_t band_height = band_rows;
+    if (!band_height)
+    {
+        const uint64_t row_bytes = sizeof(uint16_t) * config->x_pixels;
+        band_height = (row_bytes > MAX_BAND_INTENSITY_BYTES) ? 1 : (MAX_BAND_INTENSITY_BYTES / row_bytes);
+    }
+    if (band_height > config->y_pixels)
+        band_height = config->y_pixels;
+
+    fprintf(stderr, "Generating %s (%" PRIu64 "x%" PRIu64 " pixels, %hu iterations, %s) using %hu threads (%s kernel)", file_name, config->x_pixels, config->y_pixels, config->max_iterations, type_str, threads, mb_get_kernel());
+    if (band_height < config->y_pixels)
+        fprintf(stderr, ", %" PRIu64 " rows at a time", band_height);
+    fputs("... ", stderr);
+
+    //Each band is rendered and appended to the file in turn. Rendering goes straight from the kernels to the bitmap
+    //unless border tracing needs the band's intensities kept around to trace. Uncompressed bitmaps are rendered right
+    //into the mapped file when possible, so they never have to be copied out afterwards
+    const mb_render_t type = image_types_table[type_num].type;
+    const compression_t compression = image_types_table[type_num].compression;
+    format_t format = chosen_format;
+    const char* extension = strrchr(file_name, '.');
+    const bool bitmap = format_chosen ? chosen_bitmap : (!extension || !parse_format(extension + 1, &format));
+    const bool direct = !mb_get_border_tracing();
+    mb_intensities_t* band = mb_create_band(config, direct ? 0 : band_height);
+    if (!band)
+    {
+        fputs("Error: Not enough memory for the intensities (try a smaller --band-rows)\n", stderr);
+        return;
+    }
+    bmp_map_t map;
+    const bool mapped = bitmap && map_output && (compression == BI_RGB) && bmp_map_open(&map, config->x_pixels, config->y_pixels, mb_render_bpp(type), file_name);
+    bmp_stream_t stream;
+    format_stream_t format_stream;
+    bool opened = !bitmap && format_stream_open(&format_stream, format, config->x_pixels, config->y_pixels, file_name);
+    bool success = bitmap || opened;
+    for (uint64_t rows_done = 0; success && (rows_done < config->y_pixels); rows_done += band_height)
+    {
+        //Bitmaps are stored bottom row first and the other formats top row first, so they get their bands in that order
+        const uint64_t num_rows = ((config->y_pixels - rows_done) < band_height) ? (config->y_pixels - rows_done) : band_height;
+        const uint64_t first_row = bitmap ? rows_done : (config->y_pixels - rows_done - num_rows);
+        uint8_t* image_data = mapped ? bmp_map_next_rows(&map) : NULL;
+
+        bmp_t render;
+        if (direct)
+            success = mb_render_band_direct(band, first_row, num_rows, type, &render, image_data);
+        else
+        {
+            mb_generate_band(band, first_row, num_rows);
+            mb_render(band, type, &render, image_data);
+        }
+
+        if (!success)
+            fputs("Error: Not enough memory to render the rows\n", stderr);
+        else if (mapped)
+            success = bmp_map_write(&map, &render);
+        else if (!bitmap)
+            success = format_stream_write(&format_stream, &render);
+        else
+        {
+            //The header and palette are written along with the first band
+            if (!opened)
+                success = opened = bmp_stream_open(&stream, &render, config->y_pixels, file_name, compression);
+            if (success)
+                success = bmp_stream_write(&stream, &render);
+        }
+        bmp_destroy(&render);
+    }
+    if (mapped)
+        success = bmp_map_close(&map, file_name) && success;
+    else if (!bitmap && opened)
+        success = format_stream_close(&format_stream, file_name) && success;
+    else if (opened)
+        success = bmp_stream_close(&stream, file_name) && success;
+
+    if (success && (band->precision == MB_PRECISION_PERTURB))
+        fputs("done (deep zoom, perturbation from the centre)\n", stderr);
+    else if (success && (band->precision == MB_PRECISION_DOUBLE_DOUBLE))
+        fputs("done (zoomed in past doubles, double-double precision)\n", stderr);
+    else if (success)
+        fprintf(stderr, "done (%" PRIu64 " pixels inside the main cardioid/period-2 bulb skipped, %" PRIu64 " filled by border tracing, %" PRIu64 " mirrored)\n", band->interior_px, band->filled_px, band->mirrored_px);
     else
         fputs("Error: Failed to save\n", stderr);
 
-    mb_destroy_intensities(intensities);
+    mb_destroy_intensities(band);
 }
@@ -0,0 +1,381 @@
+/* Image formats besides bitmaps: QOI, binary PGM and binary PPM
+ * By: John Jekel
+*/
+
+/* Constants And Defines */
+
+//QOI rows are encoded in parallel, in jobs of about QOI_JOB_BYTES of worst case output each. Jobs are run in batches
+//of at most QOI_BATCH_BYTES so the buffers don't grow with the image, and each batch is written out all at once
+#define QOI_JOB_BYTES (256 * 1024)
+#define QOI_BATCH_BYTES (64 * 1024 * 1024)
+
+//Every pixel fits in a QOI_OP_RGB (4 bytes), and a job's last run takes 1 more
+#define QOI_MAX_PX_BYTES 4
+
+#define QOI_HEADER_BYTES 14
+#define QOI_MAX_RUN 62
+
+//Opcodes (QOI_OP_INDEX is 0, so an index is its own opcode)
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+
+//Pixels are packed as r | (g << 8) | (b << 16) | (a << 24) with the alpha always 0xFF, so no pixel is ever 0 (which
+//is what the index starts out full of)
+#define OPAQUE 0xFF000000
+
+/* Includes */
+
+#include "formats.h"
+
+#include "bmp.h"
+#include "pool.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+
+/* Types */
+
+typedef struct
+{
+    const bmp_t* band;
+    const uint32_t* lut;//Packed pixel for each palette index
+    uint32_t first_px;//The last pixel written before the band
+    uint64_t first_job;//Of the current batch
+    uint64_t rows_per_job;
+    size_t job_capacity;//Bytes in each job's buffer (enough for its rows' worst case)
+    uint8_t* buffers;
+    uint32_t* pixels;//A row of pixels for each job to unpack into
+    size_t* lengths;//Bytes of each job's buffer that were used
+} qoi_workload_t;
+
+/* Static Function Declarations */
+
+static bool write_qoi(format_stream_t* stream, const bmp_t* band, const uint32_t* lut);
+static void qoi_encode_job(void* workload_, uint32_t job_num);
+static bool write_pnm(format_stream_t* stream, const bmp_t* band, const uint32_t* lut);
+static void unpack_row(const bmp_t* band, const uint32_t* lut, uint64_t y, uint32_t* pixels);
+static uint32_t unpack_px(const bmp_t* band, const uint32_t* lut, uint64_t x, uint64_t y);
+static void put_big_endian_32(uint8_t* destination, uint32_t data);
+
+/* Function Implementations */
+
+bool format_stream_open(format_stream_t* stream, format_t format, uint64_t width, uint64_t height, const char* file_name)
+{
+    assert(stream);
+
+    //QOI and PNM dimensions are 32 bit
+    if ((width > UINT32_MAX) || (height > UINT32_MAX))
+        return false;
+
+    stream->file = !strcmp(file_name, "-") ? stdout : fopen(file_name, "wb");
+    if (!stream->file)
+        return false;//Failed to open file for writing
+
+    stream->format = format;
+    stream->width = width;
+    stream->rows_left = height;
+    stream->last_px = OPAQUE;//QOI decoders start from black
+    stream->success = true;
+
+    //Unlike bitmaps, every size is known up front so nothing is ever patched afterwards
+    if (format == FORMAT_QOI)
+    {
+        uint8_t header[QOI_HEADER_BYTES] = {'q', 'o', 'i', 'f'};
+        put_big_endian_32(&header[4], width);
+        put_big_endian_32(&header[8], height);
+        header[12] = 3;//RGB
+        header[13] = 0;//sRGB
+        if (fwrite(header, sizeof(uint8_t), QOI_HEADER_BYTES, stream->file) != QOI_HEADER_BYTES)
+            stream->success = false;
+    }
+    else if (fprintf(stream->file, "%s\n%" PRIu64 " %" PRIu64 "\n255\n", (format == FORMAT_PGM) ? "P5" : "P6", width, height) < 0)
+        stream->success = false;
+
+    return true;
+}
+
+bool format_stream_write(format_stream_t* stream, const bmp_t* band)
+{
+    assert(stream);
+    assert(band);
+
+    if ((band->height > stream->rows_left) || (band->width != stream->width) || ((band->bpp != BPP_24) && (band->num_palette_colours > 256)))
+    {
+        stream->success = false;
+        return false;
+    }
+    stream->rows_left -= band->height;
+
+    //Palette indices are unpacked straight to the colour they stand for
+    uint32_t lut[256];
+    for (uint_fast16_t i = 0; i < 256; ++i)
+    {
+        const palette_colour_t colour = (i < band->num_palette_colours) ? band->palette[i] : (palette_colour_t){.r = 0, .g = 0, .b = 0, .a = 0};
+        lut[i] = colour.r | (colour.g << 8) | ((uint32_t) colour.b << 16) | OPAQUE;
+    }
+
+    const bool success = (stream->format == FORMAT_QOI) ? write_qoi(stream, band, lut) : write_pnm(stream, band, lut);
+    if (!success)
+        stream->success = false;
+    return success;
+}
+
+bool format_stream_close(format_stream_t* stream, const char* file_name)
+{
+    assert(stream);
+
+    if (stream->rows_left)//Not all of the image was written
+        stream->success = false;
+
+    if (stream->success && (stream->format == FORMAT_QOI))
+    {
+        static const uint8_t end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+        if (fwrite(end_marker, sizeof(uint8_t), sizeof(end_marker), stream->file) != sizeof(end_marker))
+            stream->success = false;
+    }
+
+    //Close file (just flushing standard output) and return success
+    const bool to_stdout = stream->file == stdout;
+    if (to_stdout ? fflush(stdout) : fclose(stream->file))
+        stream->success = false;
+
+    if (!stream->success)
+    {
+        if (!to_stdout)
+            remove(file_name);
+        return false;
+    }
+    else
+        return true;
+}
+
+/* Static Function Implementations */
+
+static bool write_qoi(format_stream_t* stream, const bmp_t* band, const uint32_t* lut)
+{
+    if (!band->height || !band->width)
+        return true;
+
+    const size_t row_capacity = band->width * QOI_MAX_PX_BYTES;
+    const uint64_t rows_per_job = (row_capacity < QOI_JOB_BYTES) ? (QOI_JOB_BYTES / row_capacity) : 1;
+    const uint64_t num_jobs = (band->height + rows_per_job - 1) / rows_per_job;
+    const size_t job_capacity = (rows_per_job * row_capacity) + 1;
+    uint64_t jobs_per_batch = (job_capacity < QOI_BATCH_BYTES) ? (QOI_BATCH_BYTES / job_capacity) : 1;
+    if (jobs_per_batch > num_jobs)
+        jobs_per_batch = num_jobs;
+
+    qoi_workload_t workload = {.band = band, .lut = lut, .first_px = stream->last_px, .rows_per_job = rows_per_job, .job_capacity = job_capacity};
+    workload.buffers = (uint8_t*) malloc(jobs_per_batch * job_capacity);
+    workload.pixels = (uint32_t*) malloc(sizeof(uint32_t) * band->width * jobs_per_batch);
+    workload.lengths = (size_t*) malloc(sizeof(size_t) * jobs_per_batch);
+    bool success = workload.buffers && workload.pixels && workload.lengths;
+
+    for (workload.first_job = 0; success && (workload.first_job < num_jobs); workload.first_job += jobs_per_batch)
+    {
+        const uint64_t batch_jobs = ((num_jobs - workload.first_job) < jobs_per_batch) ? (num_jobs - workload.first_job) : jobs_per_batch;
+        pool_run(qoi_encode_job, (void*)&workload, batch_jobs);
+
+        //Close the gaps between the jobs' output and write it in one go
+        size_t batch_length = workload.lengths[0];
+        for (uint64_t k = 1; k < batch_jobs; ++k)
+        {
+            memmove(&workload.buffers[batch_length], &workload.buffers[k * job_capacity], workload.lengths[k]);
+            batch_length += workload.lengths[k];
+        }
+
+        if (fwrite(workload.buffers, sizeof(uint8_t), batch_length, stream->file) != batch_length)
+            success = false;
+    }
+
+    //The next band carries on from the band's last pixel: the end of its bottom row
+    stream->last_px = unpack_px(band, lut, band->width - 1, 0);
+
+    free(workload.buffers);
+    free(workload.pixels);
+    free(workload.lengths);
+    return success;
+}
+
+static void qoi_encode_job(void* workload_, uint32_t job_num)
+{
+    qoi_workload_t* workload = (qoi_workload_t*) workload_;
+    const bmp_t* band = workload->band;
+
+    //Rows are counted in the order they're written (from the top of the band); the last job is clipped to the bottom
+    const uint64_t first_row = (workload->first_job + job_num) * workload->rows_per_job;
+    const uint64_t end_row = ((band->height - first_row) < workload->rows_per_job) ? band->height : (first_row + workload->rows_per_job);
+
+    //Every job is encoded independently, starting from the pixel before it and an empty index. A decoder's index still
+    //holds the earlier jobs' pixels, but only entries set again within this job are ever referred to, so it agrees
+    uint32_t prev = first_row ? unpack_px(band, workload->lut, band->width - 1, band->height - first_row) : workload->first_px;
+    uint32_t index[64] = {0};
+    uint_fast8_t run = 0;
+
+    uint32_t* const pixels = &workload->pixels[job_num * band->width];
+    uint8_t* const buffer = &workload->buffers[job_num * workload->job_capacity];
+    uint8_t* out = buffer;
+    for (uint64_t i = first_row; i < end_row; ++i)
+    {
+        unpack_row(band, workload->lut, band->height - 1 - i, pixels);
+
+        for (uint64_t x = 0; x < band->width; ++x)
+        {
+            const uint32_t px = pixels[x];
+            if (px == prev)
+            {
+                if (++run == QOI_MAX_RUN)
+                {
+                    *out++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run)
+            {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const uint8_t r = px & 0xFF, g = (px >> 8) & 0xFF, b = (px >> 16) & 0xFF;
+            const uint_fast8_t hash = ((r * 3) + (g * 5) + (b * 7) + (0xFF * 11)) % 64;
+            if (index[hash] == px)
+                *out++ = hash;//QOI_OP_INDEX
+            else
+            {
+                index[hash] = px;
+
+                //Differences wrap around, as they do when decoding
+                const int8_t dr = (int8_t)(r - (prev & 0xFF));
+                const int8_t dg = (int8_t)(g - ((prev >> 8) & 0xFF));
+                const int8_t db = (int8_t)(b - ((prev >> 16) & 0xFF));
+                const int8_t dr_dg = (int8_t)(dr - dg);
+                const int8_t db_dg = (int8_t)(db - dg);
+
+                if ((dr >= -2) && (dr <= 1) && (dg >= -2) && (dg <= 1) && (db >= -2) && (db <= 1))
+                    *out++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+                else if ((dg >= -32) && (dg <= 31) && (dr_dg >= -8) && (dr_dg <= 7) && (db_dg >= -8) && (db_dg <= 7))
+                {
+                    *out++ = QOI_OP_LUMA | (dg + 32);
+                    *out++ = ((dr_dg + 8) << 4) | (db_dg + 8);
+                }
+                else
+                {
+                    *out++ = QOI_OP_RGB;
+                    *out++ = r;
+                    *out++ = g;
+                    *out++ = b;
+                }
+            }
+
+            prev = px;
+        }
+    }
+
+    //Runs don't carry over into the next job (the decoder doesn't mind one run being split in two)
+    if (run)
+        *out++ = QOI_OP_RUN | (run - 1);
+
+    workload->lengths[job_num] = out - buffer;
+}
+
+static bool write_pnm(format_stream_t* stream, const bmp_t* band, const uint32_t* lut)
+{
+    const size_t bytes_per_px = (stream->format == FORMAT_PGM) ? 1 : 3;
+    uint32_t* pixels = (uint32_t*) malloc(sizeof(uint32_t) * band->width);
+    uint8_t* row = (uint8_t*) malloc(bytes_per_px * band->width);
+    bool success = pixels && row;
+
+    //Top row first
+    for (uint64_t i = 0; success && (i < band->height); ++i)
+    {
+        unpack_row(band, lut, band->height - 1 - i, pixels);
+
+        if (stream->format == FORMAT_PGM)
+        {
+            //BT.601 luma, with weights adding up to 256 so that grey stays exactly the same
+            for (uint64_t x = 0; x < band->width; ++x)
+                row[x] = (((pixels[x] & 0xFF) * 77) + (((pixels[x] >> 8) & 0xFF) * 150) + (((pixels[x] >> 16) & 0xFF) * 29)) >> 8;
+        }
+        else
+        {
+            for (uint64_t x = 0; x < band->width; ++x)
+            {
+                row[(x * 3)] = pixels[x] & 0xFF;
+                row[(x * 3) + 1] = (pixels[x] >> 8) & 0xFF;
+                row[(x * 3) + 2] = (pixels[x] >> 16) & 0xFF;
+            }
+        }
+
+        if (fwrite(row, bytes_per_px, band->width, stream->file) != band->width)
+            success = false;
+    }
+
+    free(pixels);
+    free(row);
+    return success;
+}
+
+static void unpack_row(const bmp_t* band, const uint32_t* lut, uint64_t y, uint32_t* pixels)
+{
+    const uint8_t* row = &band->image_data_b[y * band->row_len_bytes];
+
+    //The first pixel of each byte is in its most significant bits (see bmp_px_set_1() and bmp_px_set_4())
+    switch (band->bpp)
+    {
+        case BPP_1:
+            for (uint64_t x = 0; x < band->width; ++x)
+                pixels[x] = lut[(row[x / 8] >> (7 - (x % 8))) & 1];
+            break;
+        case BPP_4:
+            for (uint64_t x = 0; x < band->width; ++x)
+                pixels[x] = lut[(x & 1) ? (row[x / 2] & 0xF) : (row[x / 2] >> 4)];
+            break;
+        case BPP_8:
+            for (uint64_t x = 0; x < band->width; ++x)
+                pixels[x] = lut[row[x]];
+            break;
+        case BPP_24://Stored blue first
+            for (uint64_t x = 0; x < band->width; ++x)
+                pixels[x] = row[(x * 3) + 2] | (row[(x * 3) + 1] << 8) | ((uint32_t) row[x * 3] << 16) | OPAQUE;
+            break;
+        default:
+            memset(pixels, 0, sizeof(uint32_t) * band->width);
+            break;
+    }
+}
+
+static uint32_t unpack_px(const bmp_t* band, const uint32_t* lut, uint64_t x, uint64_t y)
+{
+    const uint8_t* row = &band->image_data_b[y * band->row_len_bytes];
+
+    switch (band->bpp)
+    {
+        case BPP_1:
+            return lut[(row[x / 8] >> (7 - (x % 8))) & 1];
+        case BPP_4:
+            return lut[(x & 1) ? (row[x / 2] & 0xF) : (row[x / 2] >> 4)];
+        case BPP_8:
+            return lut[row[x]];
+        case BPP_24:
+            return row[(x * 3) + 2] | (row[(x * 3) + 1] << 8) | ((uint32_t) row[x * 3] << 16) | OPAQUE;
+        default:
+            return 0;
+    }
+}
+
+static void put_big_endian_32(uint8_t* destination, uint32_t data)
+{
+    //QOI integers are stored big-endian
+    destination[0] = data >> 24;
+    destination[1] = (data >> 16) & 0xFF;
+    destination[2] = (data >> 8) & 0xFF;
+    destination[3] = data & 0xFF;
+}
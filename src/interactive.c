@@ -28,7 +28,7 @@ typedef struct
 
 /* Static Function Declarations */
 
-static uint16_t prompt_for_uint(const char* str);
+static uint64_t prompt_for_uint(const char* str, uint64_t max);
 static double prompt_for_real(const char* str);
 static char* prompt_for_str(const char* str);
 static bool prompt_for_yn(const char* str);
@@ -41,13 +41,15 @@ int32_t interactive(void)
     interactive_intensity_gen_struct_t async_struct;
 
     //Prompt for info needed to generate intensities
-    async_struct.config.x_pixels = prompt_for_uint("Enter the x resolution of the image (positive integer < 65536): ");
-    async_struct.config.y_pixels = prompt_for_uint("Enter the y resolution of the image (positive integer < 65536): ");
+    async_struct.config.x_pixels = prompt_for_uint("Enter the x resolution of the image (positive integer < 2^31): ", INT32_MAX);
+    async_struct.config.y_pixels = prompt_for_uint("Enter the y resolution of the image (positive integer < 2^31): ", INT32_MAX);
     async_struct.config.min_x = prompt_for_real("Enter the lower real bound of the fractal to produce: ");
     async_struct.config.max_x = prompt_for_real("Enter the upper real bound of the fractal to produce: ");
     async_struct.config.min_y = prompt_for_real("Enter the lower imaginary bound of the fractal to produce: ");
     async_struct.config.max_y = prompt_for_real("Enter the upper imaginary bound of the fractal to produce: ");
-    mb_set_total_active_threads(prompt_for_uint("Enter the number of threads to use (positive integer < 65536): "));//TODO allow setting auto (for 0)
+    async_struct.config.precise = false;//Only as precise as doubles (deep zooms need the command line)
+    async_struct.config.max_iterations = prompt_for_uint("Enter the maximum number of iterations (positive integer < 65536, ex. 255): ", UINT16_MAX);
+    mb_set_total_active_threads(prompt_for_uint("Enter the number of threads to use (positive integer < 65536): ", UINT16_MAX));//TODO allow setting auto (for 0)
 
     //Generate intensities while we prompt for other info
     thrd_t intensity_gen_thread;
@@ -61,6 +63,12 @@ int32_t interactive(void)
 
     //Wait for the intensities to finish generating, then async_struct.intensities will be valid!
     thrd_join(intensity_gen_thread, NULL);
+    if (!async_struct.intensities)
+    {
+        fputs("Error: Not enough memory for the intensities\n", stderr);
+        free(base_name);
+        return 1;
+    }
 
     //TODO make this multithreaded + reuse code
 
@@ -127,7 +135,7 @@ int32_t interactive(void)
 
 /* Static Function Implementations */
 
-static uint16_t prompt_for_uint(const char* str)
+static uint64_t prompt_for_uint(const char* str, uint64_t max)
 {
     const size_t input_buffer_size = 64;//Should be enough for a whole int64_t
     char input_buffer[input_buffer_size];
@@ -139,9 +147,9 @@ static uint16_t prompt_for_uint(const char* str)
         fgets(input_buffer, input_buffer_size, stdin);
         input_int = atol(input_buffer);
 
-    } while ((input_int < 1) || (input_int > UINT_MAX));
+    } while ((input_int < 1) || ((uint64_t) input_int > max));
 
-    return (uint16_t) input_int;
+    return (uint64_t) input_int;
 }
 
 static double prompt_for_real(const char* str)
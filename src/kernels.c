@@ -0,0 +1,1121 @@
+/* Mandelbrot iteration kernels
+ * By: John Jekel
+ *
+ * This file is compiled several times with different instruction set flags. Which kernel it provides is chosen by
+ * the MBBMP_KERNEL_* define CMake passes along with those flags
+*/
+
+/* Constants And Defines */
+
+#define CONVERGE_VALUE 2
+
+//The per-ISA iteration code is written once with the iteration limit as a parameter and force-inlined into a copy of the
+//region loop for each specialised limit, so each copy is compiled with its limit as a constant
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+//Brent-style periodicity checking: each lane saves its z at iterations 1, 2, 4, 8, ... and is retired as never escaping
+//if its orbit comes back to within PERIODICITY_EPSILON of the saved point (from PERIODICITY_MIN_ITERATIONS on)
+#define PERIODICITY_EPSILON 1e-12
+
+//Number of independent vectors each SIMD kernel iterates together, so that while one chain waits on the latency of
+//its multiplies/adds the others can be issued. Can be overridden by compiling with -DMBBMP_KERNEL_CHAINS=n
+//(keep it a power of two so that groups of pixels evenly divide TILE_WIDTH, and small enough for the masks: see below)
+#ifdef MBBMP_KERNEL_CHAINS
+#define CHAINS MBBMP_KERNEL_CHAINS
+#else
+#define CHAINS 4
+#endif
+
+#if defined(MBBMP_KERNEL_AVX512)
+#define KERNEL_REGION kernel_region_avx512
+#define KERNEL_REGION_REFILL kernel_region_avx512_refill
+#define KERNEL_REGION_PERTURB kernel_region_avx512_perturb
+#define LANES 8
+#elif defined(MBBMP_KERNEL_AVX2)
+#define KERNEL_REGION kernel_region_avx2
+#define KERNEL_REGION_REFILL kernel_region_avx2_refill
+#define KERNEL_REGION_PERTURB kernel_region_avx2_perturb
+#define LANES 4
+#elif defined(MBBMP_KERNEL_AVX)
+#define KERNEL_REGION kernel_region_avx
+#define KERNEL_REGION_REFILL kernel_region_avx_refill
+#define KERNEL_REGION_PERTURB kernel_region_avx_perturb
+#define LANES 4
+#elif defined(MBBMP_KERNEL_SSE2)
+#define KERNEL_REGION kernel_region_sse2
+#define KERNEL_REGION_REFILL kernel_region_sse2_refill
+#define KERNEL_REGION_PERTURB kernel_region_sse2_perturb
+#define LANES 2
+#else
+#define KERNEL_REGION kernel_region_scalar
+#define KERNEL_REGION_PERTURB kernel_region_scalar_perturb
+#endif
+
+#ifdef LANES
+//Each chain's lanes get their own bits of a 64 bit mask of the pixels found inside the cardioid/bulb
+_Static_assert((LANES * CHAINS) <= 64, "MBBMP_KERNEL_CHAINS is too high: LANES * CHAINS must be at most 64");
+#endif
+
+/* Includes */
+
+#include "kernels.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+#if defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2) || defined(MBBMP_KERNEL_AVX512)
+#include <immintrin.h>
+#elif defined(MBBMP_KERNEL_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* Types */
+
+#ifdef LANES
+//Per-lane state for the refill kernels, kept in memory between bursts of vector iterations
+typedef struct
+{
+    _Alignas(64) double z_real[LANES];
+    _Alignas(64) double z_imag[LANES];
+    _Alignas(64) double c_real[LANES];
+    _Alignas(64) double c_imag[LANES];
+    _Alignas(64) double count[LANES];//Doubles hold counts exactly and avoid needing integer vector instructions
+    _Alignas(64) double saved_real[LANES];//Point each lane's orbit is checked against for periodicity
+    _Alignas(64) double saved_imag[LANES];
+    _Alignas(64) double next_save[LANES];//Count at which the saved point is next replaced (doubles each time)
+    _Alignas(64) double reference_index[LANES];//Perturbation only: the point of the reference orbit each lane's z is relative to
+
+    uint16_t* destination[LANES];//Where each lane's current pixel's count goes
+} lane_state_t;
+#endif
+
+/* Static Function Declarations */
+
+static ALWAYS_INLINE uint64_t region_iterate(const kernel_region_t* region, uint16_t max_iterations);
+static inline bool in_cardioid_or_bulb(double c_real, double c_imag);
+
+#ifndef LANES
+static ALWAYS_INLINE uint16_t mandelbrot_iterations_basic(complex double c, uint16_t max_iterations);
+static ALWAYS_INLINE uint16_t perturb_iterations_basic(double c_real, double c_imag, const kernel_region_t* region);
+#endif
+
+//These return a mask of which pixels (bit 0 is the first) were inside the main cardioid or period-2 bulb
+#if defined(MBBMP_KERNEL_AVX512)
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_avx512_8(const __m512d c_real[CHAINS], __m512d c_imag, const __mmask8 lanes[CHAINS], uint16_t* restrict intensities, uint16_t max_iterations);
+#elif defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_avx_4(const __m256d c_real[CHAINS], __m256d c_imag, uint16_t* restrict intensities, uint16_t max_iterations);//This is also for avx2
+#elif defined(MBBMP_KERNEL_SSE2)
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_sse2_2(const __m128d c_real[CHAINS], __m128d c_imag, uint16_t* restrict intensities, uint16_t max_iterations);
+#endif
+
+#ifdef LANES
+static ALWAYS_INLINE uint64_t region_refill(const kernel_region_t* region, bool perturb);
+static bool lane_load_next_pixel(lane_state_t* restrict lanes, uint_fast8_t lane, const kernel_region_t* restrict region, uint64_t* restrict next_px, uint64_t* restrict interior_px);
+static uint_fast8_t lanes_iterate_until_done(lane_state_t* restrict lanes, uint_fast8_t active, uint16_t max_iterations);
+static uint_fast8_t lanes_perturb_until_done(lane_state_t* restrict lanes, uint_fast8_t active, const kernel_region_t* restrict region);
+#endif
+
+/* Function Implementations */
+
+uint64_t KERNEL_REGION(const kernel_region_t* region)
+{
+    //Common limits get their own copy of the kernel; anything else goes through the generic one
+    switch (region->max_iterations)
+    {
+        case 255:
+            return region_iterate(region, 255);
+        case 1000:
+            return region_iterate(region, 1000);
+        case 4096:
+            return region_iterate(region, 4096);
+        case 65535:
+            return region_iterate(region, 65535);
+        default:
+            return region_iterate(region, region->max_iterations);
+    }
+}
+
+#ifdef LANES
+uint64_t KERNEL_REGION_REFILL(const kernel_region_t* region)
+{
+    return region_refill(region, false);
+}
+#endif
+
+uint64_t KERNEL_REGION_PERTURB(const kernel_region_t* region)
+{
+#ifdef LANES
+    return region_refill(region, true);//Lanes are rebased independently of each other, so they need refilling anyway
+#else
+    for (uint64_t j = region->min_y_px; j < region->max_y_px; ++j)
+    {
+        uint16_t* row = kernel_region_row(region, j);
+        const double y = region->min_y + (j * region->y_step);
+
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; ++i)
+            row[i] = perturb_iterations_basic(region->min_x + (i * region->x_step), y, region);
+    }
+
+    return 0;//The cardioid/bulb check needs absolute coordinates, so nothing is skipped
+#endif
+}
+
+/* Static Function Implementations */
+
+#ifdef LANES
+static ALWAYS_INLINE uint64_t region_refill(const kernel_region_t* region, bool perturb)
+{
+    //Rather than waiting for every lane in a vector to converge, a lane that finishes writes out its count and
+    //immediately picks up the next pending pixel of the region, so the vector stays full along the set's boundary
+    lane_state_t lanes;
+    uint64_t next_px = 0;
+    uint64_t interior_px = 0;
+    uint_fast8_t active = 0;
+
+    for (uint_fast8_t lane = 0; lane < LANES; ++lane)
+    {
+        if (lane_load_next_pixel(&lanes, lane, region, &next_px, &interior_px))
+            active |= 1 << lane;
+    }
+
+    while (active)
+    {
+        uint_fast8_t done = perturb ? lanes_perturb_until_done(&lanes, active, region) : lanes_iterate_until_done(&lanes, active, region->max_iterations);
+
+        for (uint_fast8_t lane = 0; lane < LANES; ++lane)
+        {
+            if (done & (1 << lane))
+            {
+                *lanes.destination[lane] = (uint16_t) lanes.count[lane];
+
+                if (!lane_load_next_pixel(&lanes, lane, region, &next_px, &interior_px))
+                    active &= ~(1 << lane);//Nothing left to do, so this lane sits idle until the others finish
+            }
+        }
+    }
+
+    return interior_px;
+}
+#endif
+
+static ALWAYS_INLINE uint64_t region_iterate(const kernel_region_t* region, uint16_t max_iterations)
+{
+    uint64_t interior_px = 0;
+
+    //Rows are walked one after another (and each row left to right) so that stores to intensities stay contiguous
+    for (uint64_t j = region->min_y_px; j < region->max_y_px; ++j)
+    {
+        uint16_t* row = kernel_region_row(region, j);
+        const double y = region->min_y + (j * region->y_step);
+
+#if defined(MBBMP_KERNEL_AVX512)
+        const __m512d lane_offsets = _mm512_mul_pd(_mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0), _mm512_set1_pd(region->x_step));
+        const __m512d imag = _mm512_set1_pd(y);
+
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; i += 8 * CHAINS)
+        {
+            //Perform mandelbrot iterations on 8 * CHAINS values at once!
+            //The last group may not fill every chain, in which case the extra lanes are masked off from the start
+            const int64_t group_px = region->max_x_px - i;
+            __m512d real[CHAINS];
+            __mmask8 lanes[CHAINS];
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+            {
+                const int64_t chain_px = group_px - (8 * k);
+                lanes[k] = (chain_px <= 0) ? 0 : ((chain_px >= 8) ? 0xFF : (__mmask8)((1u << chain_px) - 1));
+
+                const double x = region->min_x + ((i + (8 * k)) * region->x_step);
+                real[k] = _mm512_add_pd(_mm512_set1_pd(x), lane_offsets);
+            }
+
+            interior_px += __builtin_popcountll(mandelbrot_iterations_avx512_8(real, imag, lanes, &row[i], max_iterations));
+        }
+#elif defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+        const __m256d lane_offsets = _mm256_mul_pd(_mm256_set_pd(3, 2, 1, 0), _mm256_set1_pd(region->x_step));
+        const __m256d imag = _mm256_set1_pd(y);
+
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; i += 4 * CHAINS)
+        {
+            //Perform mandelbrot iterations on 4 * CHAINS values at once!
+            __m256d real[CHAINS];
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+            {
+                const double x = region->min_x + ((i + (4 * k)) * region->x_step);
+                real[k] = _mm256_add_pd(_mm256_set1_pd(x), lane_offsets);
+            }
+
+            if (((region->max_x_px - i) >= (4 * CHAINS)) && !((uintptr_t)&row[i] % 16))
+                interior_px += __builtin_popcountll(mandelbrot_iterations_avx_4(real, imag, &row[i], max_iterations));
+            else
+            {
+                //Tail of the row (or a misaligned group): iterate the whole group into an aligned buffer, but only keep
+                //the pixels that are inside the region
+                _Alignas(64) uint16_t group[4 * CHAINS];
+                uint64_t interior = mandelbrot_iterations_avx_4(real, imag, group, max_iterations);
+
+                const uint64_t group_px = ((region->max_x_px - i) < (4 * CHAINS)) ? (region->max_x_px - i) : (4 * CHAINS);
+                memcpy(&row[i], group, group_px * sizeof(uint16_t));
+                interior_px += __builtin_popcountll(interior & (UINT64_MAX >> (64 - group_px)));
+            }
+        }
+#elif defined(MBBMP_KERNEL_SSE2)
+        const __m128d lane_offsets = _mm_set_pd(region->x_step, 0);
+        const __m128d imag = _mm_set_pd1(y);
+
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; i += 2 * CHAINS)
+        {
+            //Perform mandelbrot iterations on 2 * CHAINS values at once!
+            __m128d real[CHAINS];
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+            {
+                const double x = region->min_x + ((i + (2 * k)) * region->x_step);
+                real[k] = _mm_add_pd(_mm_set_pd1(x), lane_offsets);
+            }
+
+            if (((region->max_x_px - i) >= (2 * CHAINS)) && !((uintptr_t)&row[i] % 16))
+                interior_px += __builtin_popcountll(mandelbrot_iterations_sse2_2(real, imag, &row[i], max_iterations));
+            else
+            {
+                //Tail of the row (or a misaligned group): iterate the whole group into an aligned buffer, but only keep
+                //the pixels that are inside the region
+                _Alignas(64) uint16_t group[2 * CHAINS];
+                uint64_t interior = mandelbrot_iterations_sse2_2(real, imag, group, max_iterations);
+
+                const uint64_t group_px = ((region->max_x_px - i) < (2 * CHAINS)) ? (region->max_x_px - i) : (2 * CHAINS);
+                memcpy(&row[i], group, group_px * sizeof(uint16_t));
+                interior_px += __builtin_popcountll(interior & (UINT64_MAX >> (64 - group_px)));
+            }
+        }
+#else
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; ++i)
+        {
+            const double x = region->min_x + (i * region->x_step);
+
+            if (in_cardioid_or_bulb(x, y))
+            {
+                row[i] = max_iterations;
+                ++interior_px;
+            }
+            else
+                row[i] = mandelbrot_iterations_basic(CMPLX(x, y), max_iterations);
+        }
+#endif
+    }
+
+    return interior_px;
+}
+
+//Points inside the main cardioid or the period-2 bulb never escape, so they can be given max_iterations without iterating
+//(this is where most of the set's interior is in zoomed out images)
+static inline bool in_cardioid_or_bulb(double c_real, double c_imag)
+{
+    const double imag_squared = c_imag * c_imag;
+
+    //Main cardioid: q(q + (x - 1/4)) < y^2 / 4, where q = (x - 1/4)^2 + y^2
+    const double real_shifted = c_real - 0.25;
+    const double q = (real_shifted * real_shifted) + imag_squared;
+    if ((q * (q + real_shifted)) < (0.25 * imag_squared))
+        return true;
+
+    //Period-2 bulb: (x + 1)^2 + y^2 < 1/16
+    const double real_plus_one = c_real + 1;
+    return ((real_plus_one * real_plus_one) + imag_squared) < 0.0625;
+}
+
+#ifdef LANES
+static bool lane_load_next_pixel(lane_state_t* restrict lanes, uint_fast8_t lane, const kernel_region_t* restrict region, uint64_t* restrict next_px, uint64_t* restrict interior_px)
+{
+    const uint64_t width = region->max_x_px - region->min_x_px;
+    const uint64_t total_px = width * (region->max_y_px - region->min_y_px);
+
+    lanes->z_real[lane] = 0;
+    lanes->z_imag[lane] = 0;
+    lanes->count[lane] = 0;
+    lanes->saved_real[lane] = 0;
+    lanes->saved_imag[lane] = 0;
+    lanes->next_save[lane] = 1;
+    lanes->reference_index[lane] = 0;
+
+    while (*next_px < total_px)
+    {
+        //Pending pixels are handed out in row-major order
+        const uint64_t i = region->min_x_px + (*next_px % width);
+        const uint64_t j = region->min_y_px + (*next_px / width);
+        ++*next_px;
+
+        const double x = region->min_x + (i * region->x_step);
+        const double y = region->min_y + (j * region->y_step);
+        uint16_t* destination = &kernel_region_row(region, j)[i];
+
+        //Pixels that are known to be in the set are filled in straight away rather than taking up a lane (when perturbing,
+        //x and y are only relative to the reference point so this can't be checked)
+        if (!region->reference_real && in_cardioid_or_bulb(x, y))
+        {
+            *destination = region->max_iterations;
+            ++*interior_px;
+            continue;
+        }
+
+        lanes->c_real[lane] = x;
+        lanes->c_imag[lane] = y;
+        lanes->destination[lane] = destination;
+        return true;
+    }
+
+    //Idle lanes sit at c = 0, which never escapes
+    lanes->c_real[lane] = 0;
+    lanes->c_imag[lane] = 0;
+    return false;
+}
+
+//Iterates all lanes until at least one active lane either escapes or reaches max_iterations, returning the mask of those lanes
+static uint_fast8_t lanes_iterate_until_done(lane_state_t* restrict lanes, uint_fast8_t active, uint16_t max_iterations)
+{
+#if defined(MBBMP_KERNEL_AVX512)
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d max_count = _mm512_set1_pd(max_iterations);
+
+    const __m512d epsilon = _mm512_set1_pd(PERIODICITY_EPSILON);
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+
+    __m512d z_real = _mm512_load_pd(lanes->z_real);
+    __m512d z_imag = _mm512_load_pd(lanes->z_imag);
+    const __m512d c_real = _mm512_load_pd(lanes->c_real);
+    const __m512d c_imag = _mm512_load_pd(lanes->c_imag);
+    __m512d count = _mm512_load_pd(lanes->count);
+    __m512d saved_real = _mm512_load_pd(lanes->saved_real);
+    __m512d saved_imag = _mm512_load_pd(lanes->saved_imag);
+    __m512d next_save = _mm512_load_pd(lanes->next_save);
+
+    __mmask8 done;
+    while (true)
+    {
+        __m512d z_real_squared = _mm512_mul_pd(z_real, z_real);
+        __m512d z_imag_squared = _mm512_mul_pd(z_imag, z_imag);
+        __m512d squared_sum = _mm512_add_pd(z_real_squared, z_imag_squared);
+
+        //A lane is done when it escapes or runs out of iterations
+        done = _mm512_mask_cmp_pd_mask(active, squared_sum, four, _CMP_GE_OQ) | _mm512_mask_cmp_pd_mask(active, count, max_count, _CMP_GE_OQ);
+        if (done)
+            break;
+
+        z_imag = _mm512_fmadd_pd(_mm512_add_pd(z_real, z_real), z_imag, c_imag);
+        z_real = _mm512_add_pd(_mm512_sub_pd(z_real_squared, z_imag_squared), c_real);
+        count = _mm512_add_pd(count, one);
+
+        if (check_periodicity)
+        {
+            //Lanes that have come back to their saved point are in a cycle, so they skip straight to the limit
+            __mmask8 periodic = _mm512_cmp_pd_mask(_mm512_abs_pd(_mm512_sub_pd(z_real, saved_real)), epsilon, _CMP_LT_OQ);
+            periodic = _mm512_mask_cmp_pd_mask(periodic, _mm512_abs_pd(_mm512_sub_pd(z_imag, saved_imag)), epsilon, _CMP_LT_OQ);
+            count = _mm512_mask_mov_pd(count, periodic, max_count);
+
+            __mmask8 save = _mm512_cmp_pd_mask(count, next_save, _CMP_EQ_OQ);
+            saved_real = _mm512_mask_mov_pd(saved_real, save, z_real);
+            saved_imag = _mm512_mask_mov_pd(saved_imag, save, z_imag);
+            next_save = _mm512_mask_add_pd(next_save, save, next_save, next_save);
+        }
+    }
+
+    _mm512_store_pd(lanes->z_real, z_real);
+    _mm512_store_pd(lanes->z_imag, z_imag);
+    _mm512_store_pd(lanes->count, count);
+    _mm512_store_pd(lanes->saved_real, saved_real);
+    _mm512_store_pd(lanes->saved_imag, saved_imag);
+    _mm512_store_pd(lanes->next_save, next_save);
+    return done;
+#elif defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d max_count = _mm256_set1_pd(max_iterations);
+
+    const __m256d epsilon = _mm256_set1_pd(PERIODICITY_EPSILON);
+    const __m256d sign_bit = _mm256_set1_pd(-0.0);
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+
+    __m256d z_real = _mm256_load_pd(lanes->z_real);
+    __m256d z_imag = _mm256_load_pd(lanes->z_imag);
+    const __m256d c_real = _mm256_load_pd(lanes->c_real);
+    const __m256d c_imag = _mm256_load_pd(lanes->c_imag);
+    __m256d count = _mm256_load_pd(lanes->count);
+    __m256d saved_real = _mm256_load_pd(lanes->saved_real);
+    __m256d saved_imag = _mm256_load_pd(lanes->saved_imag);
+    __m256d next_save = _mm256_load_pd(lanes->next_save);
+
+    uint_fast8_t done;
+    while (true)
+    {
+        __m256d z_real_squared = _mm256_mul_pd(z_real, z_real);
+        __m256d z_imag_squared = _mm256_mul_pd(z_imag, z_imag);
+        __m256d squared_sum = _mm256_add_pd(z_real_squared, z_imag_squared);
+
+        //A lane is done when it escapes or runs out of iterations
+        __m256d escaped = _mm256_cmp_pd(squared_sum, four, _CMP_GE_OQ);
+        __m256d exhausted = _mm256_cmp_pd(count, max_count, _CMP_GE_OQ);
+        done = _mm256_movemask_pd(_mm256_or_pd(escaped, exhausted)) & active;
+        if (done)
+            break;
+
+#ifdef __FMA__
+        z_imag = _mm256_fmadd_pd(_mm256_add_pd(z_real, z_real), z_imag, c_imag);
+#else
+        z_imag = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(z_real, z_real), z_imag), c_imag);
+#endif
+        z_real = _mm256_add_pd(_mm256_sub_pd(z_real_squared, z_imag_squared), c_real);
+        count = _mm256_add_pd(count, one);
+
+        if (check_periodicity)
+        {
+            //Lanes that have come back to their saved point are in a cycle, so they skip straight to the limit
+            __m256d close_real = _mm256_cmp_pd(_mm256_andnot_pd(sign_bit, _mm256_sub_pd(z_real, saved_real)), epsilon, _CMP_LT_OQ);
+            __m256d close_imag = _mm256_cmp_pd(_mm256_andnot_pd(sign_bit, _mm256_sub_pd(z_imag, saved_imag)), epsilon, _CMP_LT_OQ);
+            __m256d periodic = _mm256_and_pd(close_real, close_imag);
+            count = _mm256_blendv_pd(count, max_count, periodic);
+
+            __m256d save = _mm256_cmp_pd(count, next_save, _CMP_EQ_OQ);
+            saved_real = _mm256_blendv_pd(saved_real, z_real, save);
+            saved_imag = _mm256_blendv_pd(saved_imag, z_imag, save);
+            next_save = _mm256_add_pd(next_save, _mm256_and_pd(save, next_save));
+        }
+    }
+
+    _mm256_store_pd(lanes->z_real, z_real);
+    _mm256_store_pd(lanes->z_imag, z_imag);
+    _mm256_store_pd(lanes->count, count);
+    _mm256_store_pd(lanes->saved_real, saved_real);
+    _mm256_store_pd(lanes->saved_imag, saved_imag);
+    _mm256_store_pd(lanes->next_save, next_save);
+    return done;
+#elif defined(MBBMP_KERNEL_SSE2)
+    const __m128d four = _mm_set1_pd(4.0);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d max_count = _mm_set1_pd(max_iterations);
+
+    const __m128d epsilon = _mm_set1_pd(PERIODICITY_EPSILON);
+    const __m128d sign_bit = _mm_set1_pd(-0.0);
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+
+    __m128d z_real = _mm_load_pd(lanes->z_real);
+    __m128d z_imag = _mm_load_pd(lanes->z_imag);
+    const __m128d c_real = _mm_load_pd(lanes->c_real);
+    const __m128d c_imag = _mm_load_pd(lanes->c_imag);
+    __m128d count = _mm_load_pd(lanes->count);
+    __m128d saved_real = _mm_load_pd(lanes->saved_real);
+    __m128d saved_imag = _mm_load_pd(lanes->saved_imag);
+    __m128d next_save = _mm_load_pd(lanes->next_save);
+
+    uint_fast8_t done;
+    while (true)
+    {
+        __m128d z_real_squared = _mm_mul_pd(z_real, z_real);
+        __m128d z_imag_squared = _mm_mul_pd(z_imag, z_imag);
+        __m128d squared_sum = _mm_add_pd(z_real_squared, z_imag_squared);
+
+        //A lane is done when it escapes or runs out of iterations
+        __m128d escaped = _mm_cmpge_pd(squared_sum, four);
+        __m128d exhausted = _mm_cmpge_pd(count, max_count);
+        done = _mm_movemask_pd(_mm_or_pd(escaped, exhausted)) & active;
+        if (done)
+            break;
+
+        z_imag = _mm_add_pd(_mm_mul_pd(_mm_add_pd(z_real, z_real), z_imag), c_imag);
+        z_real = _mm_add_pd(_mm_sub_pd(z_real_squared, z_imag_squared), c_real);
+        count = _mm_add_pd(count, one);
+
+        if (check_periodicity)
+        {
+            //Lanes that have come back to their saved point are in a cycle, so they skip straight to the limit
+            __m128d close_real = _mm_cmplt_pd(_mm_andnot_pd(sign_bit, _mm_sub_pd(z_real, saved_real)), epsilon);
+            __m128d close_imag = _mm_cmplt_pd(_mm_andnot_pd(sign_bit, _mm_sub_pd(z_imag, saved_imag)), epsilon);
+            __m128d periodic = _mm_and_pd(close_real, close_imag);
+            count = _mm_or_pd(_mm_and_pd(periodic, max_count), _mm_andnot_pd(periodic, count));
+
+            __m128d save = _mm_cmpeq_pd(count, next_save);
+            saved_real = _mm_or_pd(_mm_and_pd(save, z_real), _mm_andnot_pd(save, saved_real));
+            saved_imag = _mm_or_pd(_mm_and_pd(save, z_imag), _mm_andnot_pd(save, saved_imag));
+            next_save = _mm_add_pd(next_save, _mm_and_pd(save, next_save));
+        }
+    }
+
+    _mm_store_pd(lanes->z_real, z_real);
+    _mm_store_pd(lanes->z_imag, z_imag);
+    _mm_store_pd(lanes->count, count);
+    _mm_store_pd(lanes->saved_real, saved_real);
+    _mm_store_pd(lanes->saved_imag, saved_imag);
+    _mm_store_pd(lanes->next_save, next_save);
+    return done;
+#endif
+}
+
+//Perturbation: each lane's z is kept as a delta from the reference orbit Z (computed to high precision), since the deltas
+//stay small enough for doubles to resolve even when the pixels don't. When a lane's z gets closer to 0 than to Z (where
+//the delta would lose precision and glitch) or it reaches the end of the orbit, it is rebased onto the start of the orbit
+//with z itself as the delta. Like lanes_iterate_until_done(), returns the mask of lanes that escaped or hit the limit
+static uint_fast8_t lanes_perturb_until_done(lane_state_t* restrict lanes, uint_fast8_t active, const kernel_region_t* restrict region)
+{
+#if defined(MBBMP_KERNEL_AVX512)
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d max_count = _mm512_set1_pd(region->max_iterations);
+    const __m512d last_index = _mm512_set1_pd(region->reference_length - 1);
+
+    __m512d delta_real = _mm512_load_pd(lanes->z_real);
+    __m512d delta_imag = _mm512_load_pd(lanes->z_imag);
+    const __m512d c_real = _mm512_load_pd(lanes->c_real);
+    const __m512d c_imag = _mm512_load_pd(lanes->c_imag);
+    __m512d count = _mm512_load_pd(lanes->count);
+    __m512d index = _mm512_load_pd(lanes->reference_index);
+
+    __mmask8 done;
+    while (true)
+    {
+        const __m256i indices = _mm512_cvttpd_epi32(index);
+        __m512d reference_real = _mm512_i32gather_pd(indices, region->reference_real, sizeof(double));
+        __m512d reference_imag = _mm512_i32gather_pd(indices, region->reference_imag, sizeof(double));
+        __m512d z_real = _mm512_add_pd(reference_real, delta_real);
+        __m512d z_imag = _mm512_add_pd(reference_imag, delta_imag);
+        __m512d squared_sum = _mm512_fmadd_pd(z_real, z_real, _mm512_mul_pd(z_imag, z_imag));
+
+        //A lane is done when it escapes or runs out of iterations
+        done = _mm512_mask_cmp_pd_mask(active, squared_sum, four, _CMP_GE_OQ) | _mm512_mask_cmp_pd_mask(active, count, max_count, _CMP_GE_OQ);
+        if (done)
+            break;
+
+        __m512d delta_squared_sum = _mm512_fmadd_pd(delta_real, delta_real, _mm512_mul_pd(delta_imag, delta_imag));
+        __mmask8 rebase = _mm512_cmp_pd_mask(squared_sum, delta_squared_sum, _CMP_LT_OQ) | _mm512_cmp_pd_mask(index, last_index, _CMP_GE_OQ);
+        delta_real = _mm512_mask_mov_pd(delta_real, rebase, z_real);
+        delta_imag = _mm512_mask_mov_pd(delta_imag, rebase, z_imag);
+        reference_real = _mm512_mask_mov_pd(reference_real, rebase, zero);//Z_0 = 0
+        reference_imag = _mm512_mask_mov_pd(reference_imag, rebase, zero);
+        index = _mm512_mask_mov_pd(index, rebase, zero);
+
+        //delta_(n+1) = (2 * Z_n + delta_n) * delta_n + delta_c
+        __m512d factor_real = _mm512_add_pd(_mm512_add_pd(reference_real, reference_real), delta_real);
+        __m512d factor_imag = _mm512_add_pd(_mm512_add_pd(reference_imag, reference_imag), delta_imag);
+        __m512d next_real = _mm512_fmsub_pd(factor_real, delta_real, _mm512_fmsub_pd(factor_imag, delta_imag, c_real));
+        delta_imag = _mm512_fmadd_pd(factor_real, delta_imag, _mm512_fmadd_pd(factor_imag, delta_real, c_imag));
+        delta_real = next_real;
+
+        index = _mm512_add_pd(index, one);
+        count = _mm512_add_pd(count, one);
+    }
+
+    _mm512_store_pd(lanes->z_real, delta_real);
+    _mm512_store_pd(lanes->z_imag, delta_imag);
+    _mm512_store_pd(lanes->count, count);
+    _mm512_store_pd(lanes->reference_index, index);
+    return done;
+#elif defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d max_count = _mm256_set1_pd(region->max_iterations);
+    const __m256d last_index = _mm256_set1_pd(region->reference_length - 1);
+
+    __m256d delta_real = _mm256_load_pd(lanes->z_real);
+    __m256d delta_imag = _mm256_load_pd(lanes->z_imag);
+    const __m256d c_real = _mm256_load_pd(lanes->c_real);
+    const __m256d c_imag = _mm256_load_pd(lanes->c_imag);
+    __m256d count = _mm256_load_pd(lanes->count);
+    __m256d index = _mm256_load_pd(lanes->reference_index);
+
+    uint_fast8_t done;
+    while (true)
+    {
+#ifdef __AVX2__
+        const __m128i indices = _mm256_cvttpd_epi32(index);
+        __m256d reference_real = _mm256_i32gather_pd(region->reference_real, indices, sizeof(double));
+        __m256d reference_imag = _mm256_i32gather_pd(region->reference_imag, indices, sizeof(double));
+#else
+        _Alignas(16) int32_t indices[4];
+        _mm_store_si128((__m128i*) indices, _mm256_cvttpd_epi32(index));
+        __m256d reference_real = _mm256_set_pd(region->reference_real[indices[3]], region->reference_real[indices[2]], region->reference_real[indices[1]], region->reference_real[indices[0]]);
+        __m256d reference_imag = _mm256_set_pd(region->reference_imag[indices[3]], region->reference_imag[indices[2]], region->reference_imag[indices[1]], region->reference_imag[indices[0]]);
+#endif
+        __m256d z_real = _mm256_add_pd(reference_real, delta_real);
+        __m256d z_imag = _mm256_add_pd(reference_imag, delta_imag);
+        __m256d squared_sum = _mm256_add_pd(_mm256_mul_pd(z_real, z_real), _mm256_mul_pd(z_imag, z_imag));
+
+        //A lane is done when it escapes or runs out of iterations
+        __m256d escaped = _mm256_cmp_pd(squared_sum, four, _CMP_GE_OQ);
+        __m256d exhausted = _mm256_cmp_pd(count, max_count, _CMP_GE_OQ);
+        done = _mm256_movemask_pd(_mm256_or_pd(escaped, exhausted)) & active;
+        if (done)
+            break;
+
+        __m256d delta_squared_sum = _mm256_add_pd(_mm256_mul_pd(delta_real, delta_real), _mm256_mul_pd(delta_imag, delta_imag));
+        __m256d rebase = _mm256_or_pd(_mm256_cmp_pd(squared_sum, delta_squared_sum, _CMP_LT_OQ), _mm256_cmp_pd(index, last_index, _CMP_GE_OQ));
+        delta_real = _mm256_blendv_pd(delta_real, z_real, rebase);
+        delta_imag = _mm256_blendv_pd(delta_imag, z_imag, rebase);
+        reference_real = _mm256_blendv_pd(reference_real, zero, rebase);//Z_0 = 0
+        reference_imag = _mm256_blendv_pd(reference_imag, zero, rebase);
+        index = _mm256_blendv_pd(index, zero, rebase);
+
+        //delta_(n+1) = (2 * Z_n + delta_n) * delta_n + delta_c
+        __m256d factor_real = _mm256_add_pd(_mm256_add_pd(reference_real, reference_real), delta_real);
+        __m256d factor_imag = _mm256_add_pd(_mm256_add_pd(reference_imag, reference_imag), delta_imag);
+        __m256d next_real = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(factor_real, delta_real), _mm256_mul_pd(factor_imag, delta_imag)), c_real);
+        delta_imag = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(factor_real, delta_imag), _mm256_mul_pd(factor_imag, delta_real)), c_imag);
+        delta_real = next_real;
+
+        index = _mm256_add_pd(index, one);
+        count = _mm256_add_pd(count, one);
+    }
+
+    _mm256_store_pd(lanes->z_real, delta_real);
+    _mm256_store_pd(lanes->z_imag, delta_imag);
+    _mm256_store_pd(lanes->count, count);
+    _mm256_store_pd(lanes->reference_index, index);
+    return done;
+#elif defined(MBBMP_KERNEL_SSE2)
+    const __m128d four = _mm_set1_pd(4.0);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d max_count = _mm_set1_pd(region->max_iterations);
+    const __m128d last_index = _mm_set1_pd(region->reference_length - 1);
+
+    __m128d delta_real = _mm_load_pd(lanes->z_real);
+    __m128d delta_imag = _mm_load_pd(lanes->z_imag);
+    const __m128d c_real = _mm_load_pd(lanes->c_real);
+    const __m128d c_imag = _mm_load_pd(lanes->c_imag);
+    __m128d count = _mm_load_pd(lanes->count);
+    __m128d index = _mm_load_pd(lanes->reference_index);
+
+    uint_fast8_t done;
+    while (true)
+    {
+        _Alignas(16) int32_t indices[4];
+        _mm_store_si128((__m128i*) indices, _mm_cvttpd_epi32(index));
+        __m128d reference_real = _mm_set_pd(region->reference_real[indices[1]], region->reference_real[indices[0]]);
+        __m128d reference_imag = _mm_set_pd(region->reference_imag[indices[1]], region->reference_imag[indices[0]]);
+        __m128d z_real = _mm_add_pd(reference_real, delta_real);
+        __m128d z_imag = _mm_add_pd(reference_imag, delta_imag);
+        __m128d squared_sum = _mm_add_pd(_mm_mul_pd(z_real, z_real), _mm_mul_pd(z_imag, z_imag));
+
+        //A lane is done when it escapes or runs out of iterations
+        __m128d escaped = _mm_cmpge_pd(squared_sum, four);
+        __m128d exhausted = _mm_cmpge_pd(count, max_count);
+        done = _mm_movemask_pd(_mm_or_pd(escaped, exhausted)) & active;
+        if (done)
+            break;
+
+        __m128d delta_squared_sum = _mm_add_pd(_mm_mul_pd(delta_real, delta_real), _mm_mul_pd(delta_imag, delta_imag));
+        __m128d rebase = _mm_or_pd(_mm_cmplt_pd(squared_sum, delta_squared_sum), _mm_cmpge_pd(index, last_index));
+        delta_real = _mm_or_pd(_mm_and_pd(rebase, z_real), _mm_andnot_pd(rebase, delta_real));
+        delta_imag = _mm_or_pd(_mm_and_pd(rebase, z_imag), _mm_andnot_pd(rebase, delta_imag));
+        reference_real = _mm_andnot_pd(rebase, reference_real);//Z_0 = 0
+        reference_imag = _mm_andnot_pd(rebase, reference_imag);
+        index = _mm_andnot_pd(rebase, index);
+
+        //delta_(n+1) = (2 * Z_n + delta_n) * delta_n + delta_c
+        __m128d factor_real = _mm_add_pd(_mm_add_pd(reference_real, reference_real), delta_real);
+        __m128d factor_imag = _mm_add_pd(_mm_add_pd(reference_imag, reference_imag), delta_imag);
+        __m128d next_real = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(factor_real, delta_real), _mm_mul_pd(factor_imag, delta_imag)), c_real);
+        delta_imag = _mm_add_pd(_mm_add_pd(_mm_mul_pd(factor_real, delta_imag), _mm_mul_pd(factor_imag, delta_real)), c_imag);
+        delta_real = next_real;
+
+        index = _mm_add_pd(index, one);
+        count = _mm_add_pd(count, one);
+    }
+
+    _mm_store_pd(lanes->z_real, delta_real);
+    _mm_store_pd(lanes->z_imag, delta_imag);
+    _mm_store_pd(lanes->count, count);
+    _mm_store_pd(lanes->reference_index, index);
+    return done;
+#endif
+}
+#endif
+
+#ifndef LANES
+static ALWAYS_INLINE uint16_t mandelbrot_iterations_basic(complex double c, uint16_t max_iterations)
+{
+    complex double z = 0;//z_0 = 0
+
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+    complex double saved = 0;
+    uint_fast16_t next_save = 1;
+
+    for (uint_fast16_t i = 0; i < max_iterations; ++i)
+    {
+        double real = creal(z);
+        double imag = cimag(z);
+
+        if (((real * real) + (imag * imag)) >= (CONVERGE_VALUE * CONVERGE_VALUE))//Check if abs(z) >= CONVERGE_VALUE
+            return i;
+
+        if (check_periodicity && (i == next_save))
+        {
+            saved = z;
+            next_save *= 2;
+        }
+
+        z = (z * z) + c;//z_(n+1) = z_n^2 + c
+
+        //If the orbit has come back to the saved point it is in a cycle, so it will never escape
+        if (check_periodicity && (fabs(creal(z) - creal(saved)) < PERIODICITY_EPSILON) && (fabs(cimag(z) - cimag(saved)) < PERIODICITY_EPSILON))
+            return max_iterations;
+    }
+
+    return max_iterations;//Failed to converge within max_iterations iterations
+}
+
+//See lanes_perturb_until_done()
+static ALWAYS_INLINE uint16_t perturb_iterations_basic(double c_real, double c_imag, const kernel_region_t* region)
+{
+    double delta_real = 0, delta_imag = 0;
+    uint32_t index = 0;
+
+    for (uint_fast16_t i = 0; i < region->max_iterations; ++i)
+    {
+        const double z_real = region->reference_real[index] + delta_real;
+        const double z_imag = region->reference_imag[index] + delta_imag;
+        const double squared_sum = (z_real * z_real) + (z_imag * z_imag);
+
+        if (squared_sum >= (CONVERGE_VALUE * CONVERGE_VALUE))
+            return i;
+
+        //Rebase onto the start of the reference orbit (Z_0 = 0)
+        if ((squared_sum < ((delta_real * delta_real) + (delta_imag * delta_imag))) || (index == (region->reference_length - 1)))
+        {
+            delta_real = z_real;
+            delta_imag = z_imag;
+            index = 0;
+        }
+
+        //delta_(n+1) = (2 * Z_n + delta_n) * delta_n + delta_c
+        const double factor_real = (2 * region->reference_real[index]) + delta_real;
+        const double factor_imag = (2 * region->reference_imag[index]) + delta_imag;
+        const double next_real = (factor_real * delta_real) - (factor_imag * delta_imag) + c_real;
+        delta_imag = (factor_real * delta_imag) + (factor_imag * delta_real) + c_imag;
+        delta_real = next_real;
+        ++index;
+    }
+
+    return region->max_iterations;
+}
+#endif
+
+#if defined(MBBMP_KERNEL_SSE2)
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_sse2_2(const __m128d c_real[CHAINS], __m128d c_imag, uint16_t* restrict intensities, uint16_t max_iterations)
+{
+    const __m128d four = _mm_set_pd1(4.0);
+    const __m128d one = _mm_set_pd1(1.0);
+    const __m128d quarter = _mm_set_pd1(0.25);
+    const __m128d imag_squared = _mm_mul_pd(c_imag, c_imag);
+
+    //Counts are kept as doubles so we don't need to move between the integer and floating point domains each iteration
+    __m128d z_real[CHAINS], z_imag[CHAINS], count[CHAINS];
+    uint64_t interior = 0;
+
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+    const __m128d max_count = _mm_set_pd1(max_iterations);
+    const __m128d escaped = _mm_set_pd1(CONVERGE_VALUE);
+    const __m128d epsilon = _mm_set_pd1(PERIODICITY_EPSILON);
+    const __m128d sign_bit = _mm_set_pd1(-0.0);
+    __m128d saved_real[CHAINS], saved_imag[CHAINS];
+    uint_fast16_t next_save = 1;
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+    {
+        //Check for points inside the main cardioid or period-2 bulb (see in_cardioid_or_bulb())
+        __m128d real_shifted = _mm_sub_pd(c_real[k], quarter);
+        __m128d q = _mm_add_pd(_mm_mul_pd(real_shifted, real_shifted), imag_squared);
+        __m128d cardioid = _mm_cmplt_pd(_mm_mul_pd(q, _mm_add_pd(q, real_shifted)), _mm_mul_pd(imag_squared, quarter));
+        __m128d real_plus_one = _mm_add_pd(c_real[k], one);
+        __m128d bulb = _mm_cmplt_pd(_mm_add_pd(_mm_mul_pd(real_plus_one, real_plus_one), imag_squared), _mm_set_pd1(0.0625));
+        __m128d inside = _mm_or_pd(cardioid, bulb);
+        interior |= (uint64_t) _mm_movemask_pd(inside) << (2 * k);
+
+        //Those start out with their final count and with |z| = 2, so they are never counted or waited on
+        z_real[k] = _mm_and_pd(inside, escaped);
+        z_imag[k] = _mm_setzero_pd();
+        count[k] = _mm_and_pd(inside, max_count);
+        saved_real[k] = _mm_setzero_pd();
+        saved_imag[k] = _mm_setzero_pd();
+    }
+
+    for (uint_fast16_t i = 0; i < max_iterations; ++i)
+    {
+        __m128d any_not_converged = _mm_setzero_pd();
+
+        if (check_periodicity && (i == next_save))
+        {
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+            {
+                saved_real[k] = z_real[k];
+                saved_imag[k] = z_imag[k];
+            }
+            next_save *= 2;
+        }
+
+        for (uint_fast8_t k = 0; k < CHAINS; ++k)
+        {
+            //Calculate some values that are used below
+            __m128d z_real_squared = _mm_mul_pd(z_real[k], z_real[k]);
+            __m128d z_imag_squared = _mm_mul_pd(z_imag[k], z_imag[k]);
+
+            //Check if the modulus of each z < the converge value of 2 (aka that they have converged)
+            //We do this faster by doing (z_real * z_real) + (z_imag * z_imag) < (2 * 2)
+            __m128d compare = _mm_cmplt_pd(_mm_add_pd(z_real_squared, z_imag_squared), four);
+            any_not_converged = _mm_or_pd(any_not_converged, compare);
+
+            //Get next entries (For each complex number z, z_(n+1) = z_n^2 + c)
+            __m128d temp_zreal = _mm_add_pd(_mm_sub_pd(z_real_squared, z_imag_squared), c_real[k]);
+            z_imag[k] = _mm_add_pd(c_imag, _mm_mul_pd(_mm_add_pd(z_real[k], z_real[k]), z_imag[k]));
+            z_real[k] = temp_zreal;
+
+            //Increment the corresponding count only if we haven't converged yet
+            count[k] = _mm_add_pd(count[k], _mm_and_pd(compare, one));
+
+            if (check_periodicity)
+            {
+                //Lanes that have come back to their saved point are in a cycle, so they skip straight to the limit and
+                //are moved out to the escape radius so they aren't counted any further
+                __m128d close_real = _mm_cmplt_pd(_mm_andnot_pd(sign_bit, _mm_sub_pd(z_real[k], saved_real[k])), epsilon);
+                __m128d close_imag = _mm_cmplt_pd(_mm_andnot_pd(sign_bit, _mm_sub_pd(z_imag[k], saved_imag[k])), epsilon);
+                __m128d periodic = _mm_and_pd(compare, _mm_and_pd(close_real, close_imag));
+                count[k] = _mm_or_pd(_mm_and_pd(periodic, max_count), _mm_andnot_pd(periodic, count[k]));
+                z_real[k] = _mm_or_pd(_mm_and_pd(periodic, escaped), _mm_andnot_pd(periodic, z_real[k]));
+            }
+        }
+
+        //If every complex number in every chain has converged, return early
+        if (!_mm_movemask_pd(any_not_converged))
+            break;
+    }
+
+#if CHAINS >= 4
+    //Convert the counts to 32 bit integers and pack every 4 chains into 8 16 bit counts for one aligned store. SSE2 only
+    //has a signed pack, so the counts are biased into the signed range beforehand and back again afterwards
+    const __m128i bias_32 = _mm_set1_epi32(0x8000);
+    const __m128i bias_16 = _mm_set1_epi16((int16_t) 0x8000);
+    for (uint_fast8_t k = 0; k < CHAINS; k += 4)
+    {
+        __m128i low = _mm_unpacklo_epi64(_mm_cvtpd_epi32(count[k]), _mm_cvtpd_epi32(count[k + 1]));
+        __m128i high = _mm_unpacklo_epi64(_mm_cvtpd_epi32(count[k + 2]), _mm_cvtpd_epi32(count[k + 3]));
+        __m128i result = _mm_packs_epi32(_mm_sub_epi32(low, bias_32), _mm_sub_epi32(high, bias_32));
+        _mm_store_si128((__m128i*)&intensities[2 * k], _mm_xor_si128(result, bias_16));
+    }
+#else
+    //Too few chains to fill a whole vector, so convert the counts to 32 bit integers, then pack the low 16 bits of each
+    //into the lower 32 bits and store them
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+    {
+        __m128i result = _mm_cvtpd_epi32(count[k]);
+        result = _mm_shufflelo_epi16(result, _MM_SHUFFLE(3, 3, 2, 0));
+        _mm_storeu_si32(&intensities[2 * k], result);
+    }
+#endif
+
+    return interior;
+}
+#endif
+
+#if defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_avx_4(const __m256d c_real[CHAINS], __m256d c_imag, uint16_t* restrict intensities, uint16_t max_iterations)
+{
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d quarter = _mm256_set1_pd(0.25);
+    const __m256d imag_squared = _mm256_mul_pd(c_imag, c_imag);
+
+    //Counts are kept as doubles, which also means AVX (without AVX2) doesn't need to split integer adds in half
+    __m256d z_real[CHAINS], z_imag[CHAINS], count[CHAINS];
+    uint64_t interior = 0;
+
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+    const __m256d max_count = _mm256_set1_pd(max_iterations);
+    const __m256d escaped = _mm256_set1_pd(CONVERGE_VALUE);
+    const __m256d epsilon = _mm256_set1_pd(PERIODICITY_EPSILON);
+    const __m256d sign_bit = _mm256_set1_pd(-0.0);
+    __m256d saved_real[CHAINS], saved_imag[CHAINS];
+    uint_fast16_t next_save = 1;
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+    {
+        //Check for points inside the main cardioid or period-2 bulb (see in_cardioid_or_bulb())
+        __m256d real_shifted = _mm256_sub_pd(c_real[k], quarter);
+        __m256d q = _mm256_add_pd(_mm256_mul_pd(real_shifted, real_shifted), imag_squared);
+        __m256d cardioid = _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, real_shifted)), _mm256_mul_pd(imag_squared, quarter), _CMP_LT_OQ);
+        __m256d real_plus_one = _mm256_add_pd(c_real[k], one);
+        __m256d bulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(real_plus_one, real_plus_one), imag_squared), _mm256_set1_pd(0.0625), _CMP_LT_OQ);
+        __m256d inside = _mm256_or_pd(cardioid, bulb);
+        interior |= (uint64_t) _mm256_movemask_pd(inside) << (4 * k);
+
+        //Those start out with their final count and with |z| = 2, so they are never counted or waited on
+        z_real[k] = _mm256_and_pd(inside, escaped);
+        z_imag[k] = _mm256_setzero_pd();
+        count[k] = _mm256_and_pd(inside, max_count);
+        saved_real[k] = _mm256_setzero_pd();
+        saved_imag[k] = _mm256_setzero_pd();
+    }
+
+    for (uint_fast16_t i = 0; i < max_iterations; ++i)
+    {
+        __m256d any_not_converged = _mm256_setzero_pd();
+
+        if (check_periodicity && (i == next_save))
+        {
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+            {
+                saved_real[k] = z_real[k];
+                saved_imag[k] = z_imag[k];
+            }
+            next_save *= 2;
+        }
+
+        for (uint_fast8_t k = 0; k < CHAINS; ++k)
+        {
+            //Calculate some values that are used below
+            __m256d z_real_squared = _mm256_mul_pd(z_real[k], z_real[k]);
+            __m256d z_imag_squared = _mm256_mul_pd(z_imag[k], z_imag[k]);
+
+            //Check if the modulus of each z < the converge value of 2 (aka that they have converged)
+            //We do this faster by doing (z_real * z_real) + (z_imag * z_imag) < (2 * 2)
+            __m256d compare = _mm256_cmp_pd(_mm256_add_pd(z_real_squared, z_imag_squared), four, _CMP_LT_OQ);
+            any_not_converged = _mm256_or_pd(any_not_converged, compare);
+
+            //Get next entries (For each complex number z, z_(n+1) = z_n^2 + c)
+            __m256d temp_zreal = _mm256_add_pd(_mm256_sub_pd(z_real_squared, z_imag_squared), c_real[k]);
+#ifdef __FMA__
+            z_imag[k] = _mm256_fmadd_pd(_mm256_add_pd(z_real[k], z_real[k]), z_imag[k], c_imag);
+#else
+            z_imag[k] = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(z_real[k], z_real[k]), z_imag[k]), c_imag);
+#endif
+            z_real[k] = temp_zreal;
+
+            //Increment the corresponding count only if we haven't converged yet
+            count[k] = _mm256_add_pd(count[k], _mm256_and_pd(compare, one));
+
+            if (check_periodicity)
+            {
+                //Lanes that have come back to their saved point are in a cycle, so they skip straight to the limit and
+                //are moved out to the escape radius so they aren't counted any further
+                __m256d close_real = _mm256_cmp_pd(_mm256_andnot_pd(sign_bit, _mm256_sub_pd(z_real[k], saved_real[k])), epsilon, _CMP_LT_OQ);
+                __m256d close_imag = _mm256_cmp_pd(_mm256_andnot_pd(sign_bit, _mm256_sub_pd(z_imag[k], saved_imag[k])), epsilon, _CMP_LT_OQ);
+                __m256d periodic = _mm256_and_pd(compare, _mm256_and_pd(close_real, close_imag));
+                count[k] = _mm256_blendv_pd(count[k], max_count, periodic);
+                z_real[k] = _mm256_blendv_pd(z_real[k], escaped, periodic);
+            }
+        }
+
+        //If every complex number in every chain has converged, return early
+        if (!_mm256_movemask_pd(any_not_converged))
+            break;
+    }
+
+#if CHAINS >= 2
+    //Convert the counts to 32 bit integers, then pack each pair of chains to 8 16 bit counts for one aligned store
+    for (uint_fast8_t k = 0; k < CHAINS; k += 2)
+    {
+        __m128i result = _mm_packus_epi32(_mm256_cvtpd_epi32(count[k]), _mm256_cvtpd_epi32(count[k + 1]));
+        _mm_store_si128((__m128i*)&intensities[4 * k], result);
+    }
+#else
+    //Convert the counts to 32 bit integers, then pack them to 16 bits and store the lower 64 bits
+    __m128i result = _mm256_cvtpd_epi32(count[0]);
+    result = _mm_packus_epi32(result, result);
+    _mm_storel_epi64((__m128i*)intensities, result);
+#endif
+
+    return interior;
+}
+#endif
+
+#if defined(MBBMP_KERNEL_AVX512)
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_avx512_8(const __m512d c_real[CHAINS], __m512d c_imag, const __mmask8 lanes[CHAINS], uint16_t* restrict intensities, uint16_t max_iterations)
+{
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512i one_i = _mm512_set1_epi64(1);
+    const __m512d quarter = _mm512_set1_pd(0.25);
+    const __m512d imag_squared = _mm512_mul_pd(c_imag, c_imag);
+
+    //Lanes are retired from each chain's mask as they converge, and only the lanes still in it are updated from then on
+    __m512d z_real[CHAINS], z_imag[CHAINS];
+    __m512i result[CHAINS];
+    __mmask8 not_converged[CHAINS];
+    uint64_t interior = 0;
+
+    const bool check_periodicity = max_iterations >= PERIODICITY_MIN_ITERATIONS;
+    const __m512i max_count = _mm512_set1_epi64(max_iterations);
+    const __m512d epsilon = _mm512_set1_pd(PERIODICITY_EPSILON);
+    __m512d saved_real[CHAINS], saved_imag[CHAINS];
+    uint_fast16_t next_save = 1;
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+    {
+        //Check for points inside the main cardioid or period-2 bulb (see in_cardioid_or_bulb())
+        __m512d real_shifted = _mm512_sub_pd(c_real[k], quarter);
+        __m512d q = _mm512_add_pd(_mm512_mul_pd(real_shifted, real_shifted), imag_squared);
+        __mmask8 inside = _mm512_mask_cmp_pd_mask(lanes[k], _mm512_mul_pd(q, _mm512_add_pd(q, real_shifted)), _mm512_mul_pd(imag_squared, quarter), _CMP_LT_OQ);
+        __m512d real_plus_one = _mm512_add_pd(c_real[k], _mm512_set1_pd(1.0));
+        inside |= _mm512_mask_cmp_pd_mask(lanes[k], _mm512_add_pd(_mm512_mul_pd(real_plus_one, real_plus_one), imag_squared), _mm512_set1_pd(0.0625), _CMP_LT_OQ);
+        interior |= (uint64_t) inside << (8 * k);
+
+        //Those lanes get their final count and are retired from the start
+        z_real[k] = _mm512_setzero_pd();
+        z_imag[k] = _mm512_setzero_pd();
+        result[k] = _mm512_maskz_mov_epi64(inside, max_count);
+        not_converged[k] = lanes[k] & ~inside;
+        saved_real[k] = _mm512_setzero_pd();
+        saved_imag[k] = _mm512_setzero_pd();
+    }
+
+    for (uint_fast16_t i = 0; i < max_iterations; ++i)
+    {
+        __mmask8 any_not_converged = 0;
+
+        if (check_periodicity && (i == next_save))
+        {
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+            {
+                saved_real[k] = z_real[k];
+                saved_imag[k] = z_imag[k];
+            }
+            next_save *= 2;
+        }
+
+        for (uint_fast8_t k = 0; k < CHAINS; ++k)
+        {
+            //Calculate some values that are used below
+            __m512d z_real_squared = _mm512_mul_pd(z_real[k], z_real[k]);
+            __m512d z_imag_squared = _mm512_mul_pd(z_imag[k], z_imag[k]);
+
+            //Check if the modulus of each z < the converge value of 2 (aka that they have converged)
+            //We do this faster by doing (z_real * z_real) + (z_imag * z_imag) < (2 * 2)
+            __m512d squared_sum = _mm512_add_pd(z_real_squared, z_imag_squared);
+            not_converged[k] = _mm512_mask_cmp_pd_mask(not_converged[k], squared_sum, four, _CMP_LT_OQ);
+            any_not_converged |= not_converged[k];
+
+            //Get next entries (For each complex number z, z_(n+1) = z_n^2 + c)
+            __m512d temp_zreal = _mm512_add_pd(_mm512_sub_pd(z_real_squared, z_imag_squared), c_real[k]);
+            z_imag[k] = _mm512_mask_fmadd_pd(z_imag[k], not_converged[k], _mm512_add_pd(z_real[k], z_real[k]), c_imag);
+            z_real[k] = _mm512_mask_mov_pd(z_real[k], not_converged[k], temp_zreal);
+
+            //Increment the corresponding count only if we haven't converged yet
+            result[k] = _mm512_mask_add_epi64(result[k], not_converged[k], result[k], one_i);
+
+            if (check_periodicity)
+            {
+                //Lanes that have come back to their saved point are in a cycle, so they skip straight to the limit
+                __mmask8 periodic = _mm512_mask_cmp_pd_mask(not_converged[k], _mm512_abs_pd(_mm512_sub_pd(z_real[k], saved_real[k])), epsilon, _CMP_LT_OQ);
+                periodic = _mm512_mask_cmp_pd_mask(periodic, _mm512_abs_pd(_mm512_sub_pd(z_imag[k], saved_imag[k])), epsilon, _CMP_LT_OQ);
+                result[k] = _mm512_mask_mov_epi64(result[k], periodic, max_count);
+                not_converged[k] &= ~periodic;
+            }
+        }
+
+        //If every complex number in every chain has converged (all masks are 0), return early
+        if (!any_not_converged)
+            break;
+    }
+
+    //Narrow the 64 bit counts to 16 bits while storing them, skipping lanes past the end of the region
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+        _mm512_mask_cvtepi64_storeu_epi16(&intensities[8 * k], lanes[k], result[k]);
+
+    return interior;
+}
+#endif
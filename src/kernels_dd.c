@@ -0,0 +1,260 @@
+/* Double-double iteration kernels
+ * By: John Jekel
+ *
+ * Like kernels.c, this file is compiled once per instruction set. Each number is kept as the unevaluated sum of two
+ * doubles (hi + lo, about 106 bits), which is enough for zooms that doubles can no longer resolve but that aren't deep
+ * enough to need perturbation. The error-free transformations this relies on are exactly what -ffast-math's
+ * reassociation "simplifies" away, so CMake compiles this file with -fno-fast-math
+*/
+
+/* Constants And Defines */
+
+#define CONVERGE_VALUE 2
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+//Splits a double into two halves whose products are exact, for error-free multiplication without FMA (Dekker)
+#define SPLITTER 134217729.0//2^27 + 1
+
+//The double-double arithmetic is written once in terms of these, so only they need defining for each instruction set.
+//Masks track which lanes have escaped; once they have, their z is left to overflow (and may become NaN)
+#if defined(MBBMP_KERNEL_AVX512)
+#define KERNEL_REGION_DD kernel_region_avx512_dd
+#define LANES 8
+#define VEC_T __m512d
+#define MASK_T __mmask8
+#define VEC_SET1(x) _mm512_set1_pd(x)
+#define VEC_LANE_OFFSETS() _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0)
+#define VEC_STORE(p, a) _mm512_store_pd(p, a)
+#define VEC_ADD(a, b) _mm512_add_pd(a, b)
+#define VEC_SUB(a, b) _mm512_sub_pd(a, b)
+#define VEC_MUL(a, b) _mm512_mul_pd(a, b)
+#define VEC_FMS(a, b, c) _mm512_fmsub_pd(a, b, c)
+#define VEC_ADD_UNLESS(a, mask, b) _mm512_mask_add_pd(a, ~(mask), a, b)
+#define MASK_NONE() ((__mmask8) 0)
+#define MASK_GE(a, b) _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ)
+#define MASK_OR(a, b) ((a) | (b))
+#define MASK_BITS(mask) ((uint_fast8_t)(mask))
+#elif defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+#ifdef MBBMP_KERNEL_AVX2
+#define KERNEL_REGION_DD kernel_region_avx2_dd
+#define VEC_FMS(a, b, c) _mm256_fmsub_pd(a, b, c)
+#else
+#define KERNEL_REGION_DD kernel_region_avx_dd
+#endif
+#define LANES 4
+#define VEC_T __m256d
+#define MASK_T __m256d
+#define VEC_SET1(x) _mm256_set1_pd(x)
+#define VEC_LANE_OFFSETS() _mm256_set_pd(3, 2, 1, 0)
+#define VEC_STORE(p, a) _mm256_store_pd(p, a)
+#define VEC_ADD(a, b) _mm256_add_pd(a, b)
+#define VEC_SUB(a, b) _mm256_sub_pd(a, b)
+#define VEC_MUL(a, b) _mm256_mul_pd(a, b)
+#define VEC_ADD_UNLESS(a, mask, b) _mm256_add_pd(a, _mm256_andnot_pd(mask, b))
+#define MASK_NONE() _mm256_setzero_pd()
+#define MASK_GE(a, b) _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define MASK_OR(a, b) _mm256_or_pd(a, b)
+#define MASK_BITS(mask) ((uint_fast8_t) _mm256_movemask_pd(mask))
+#elif defined(MBBMP_KERNEL_SSE2)
+#define KERNEL_REGION_DD kernel_region_sse2_dd
+#define LANES 2
+#define VEC_T __m128d
+#define MASK_T __m128d
+#define VEC_SET1(x) _mm_set1_pd(x)
+#define VEC_LANE_OFFSETS() _mm_set_pd(1, 0)
+#define VEC_STORE(p, a) _mm_store_pd(p, a)
+#define VEC_ADD(a, b) _mm_add_pd(a, b)
+#define VEC_SUB(a, b) _mm_sub_pd(a, b)
+#define VEC_MUL(a, b) _mm_mul_pd(a, b)
+#define VEC_ADD_UNLESS(a, mask, b) _mm_add_pd(a, _mm_andnot_pd(mask, b))
+#define MASK_NONE() _mm_setzero_pd()
+#define MASK_GE(a, b) _mm_cmpge_pd(a, b)
+#define MASK_OR(a, b) _mm_or_pd(a, b)
+#define MASK_BITS(mask) ((uint_fast8_t) _mm_movemask_pd(mask))
+#else
+#define KERNEL_REGION_DD kernel_region_scalar_dd
+#define LANES 1
+#define VEC_T double
+#define MASK_T bool
+#define VEC_SET1(x) ((double)(x))
+#define VEC_LANE_OFFSETS() 0.0
+#define VEC_STORE(p, a) (*(p) = (a))
+#define VEC_ADD(a, b) ((a) + (b))
+#define VEC_SUB(a, b) ((a) - (b))
+#define VEC_MUL(a, b) ((a) * (b))
+#define VEC_ADD_UNLESS(a, mask, b) ((mask) ? (a) : ((a) + (b)))
+#define MASK_NONE() false
+#define MASK_GE(a, b) ((a) >= (b))
+#define MASK_OR(a, b) ((a) || (b))
+#define MASK_BITS(mask) ((uint_fast8_t)(mask))
+#endif
+
+#define ALL_LANES ((1u << LANES) - 1)
+
+/* Includes */
+
+#include "kernels.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2) || defined(MBBMP_KERNEL_AVX512)
+#include <immintrin.h>
+#elif defined(MBBMP_KERNEL_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* Types */
+
+typedef struct
+{
+    VEC_T hi, lo;
+} dd_t;
+
+/* Static Function Declarations */
+
+static ALWAYS_INLINE dd_t two_sum(VEC_T a, VEC_T b);
+static ALWAYS_INLINE dd_t quick_two_sum(VEC_T a, VEC_T b);//Only if |a| >= |b|
+static ALWAYS_INLINE dd_t two_prod(VEC_T a, VEC_T b);
+static ALWAYS_INLINE dd_t dd_add(dd_t a, dd_t b);
+static ALWAYS_INLINE dd_t dd_sub(dd_t a, dd_t b);
+static ALWAYS_INLINE dd_t dd_mul(dd_t a, dd_t b);
+static ALWAYS_INLINE dd_t dd_sqr(dd_t a);
+
+static ALWAYS_INLINE VEC_T mandelbrot_iterations_dd(dd_t c_real, dd_t c_imag, uint16_t max_iterations);
+
+/* Function Implementations */
+
+uint64_t KERNEL_REGION_DD(const kernel_region_t* region)
+{
+    const dd_t min_x = {VEC_SET1(region->min_x), VEC_SET1(region->min_x_low)};
+    const VEC_T x_step = VEC_SET1(region->x_step);
+
+    for (uint64_t j = region->min_y_px; j < region->max_y_px; ++j)
+    {
+        uint16_t* row = kernel_region_row(region, j);
+
+        //Pixels are placed from their index exactly (the products are error-free), so the only error is in the step
+        const dd_t min_y = {VEC_SET1(region->min_y), VEC_SET1(region->min_y_low)};
+        const dd_t imag = dd_add(min_y, two_prod(VEC_SET1(j), VEC_SET1(region->y_step)));
+
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; i += LANES)
+        {
+            const dd_t real = dd_add(min_x, two_prod(VEC_ADD(VEC_SET1(i), VEC_LANE_OFFSETS()), x_step));
+
+            //Lanes past the end of the region are iterated too, but their counts aren't kept
+            _Alignas(64) double counts[LANES];
+            VEC_STORE(counts, mandelbrot_iterations_dd(real, imag, region->max_iterations));
+
+            const uint64_t group_px = ((region->max_x_px - i) < LANES) ? (region->max_x_px - i) : LANES;
+            for (uint64_t k = 0; k < group_px; ++k)
+                row[i + k] = (uint16_t) counts[k];
+        }
+    }
+
+    return 0;//The cardioid/bulb check isn't precise enough at these zooms, so nothing is skipped
+}
+
+/* Static Function Implementations */
+
+static ALWAYS_INLINE dd_t two_sum(VEC_T a, VEC_T b)
+{
+    const VEC_T sum = VEC_ADD(a, b);
+    const VEC_T b_virtual = VEC_SUB(sum, a);
+    const VEC_T error = VEC_ADD(VEC_SUB(a, VEC_SUB(sum, b_virtual)), VEC_SUB(b, b_virtual));
+    return (dd_t){sum, error};
+}
+
+static ALWAYS_INLINE dd_t quick_two_sum(VEC_T a, VEC_T b)
+{
+    const VEC_T sum = VEC_ADD(a, b);
+    return (dd_t){sum, VEC_SUB(b, VEC_SUB(sum, a))};
+}
+
+static ALWAYS_INLINE dd_t two_prod(VEC_T a, VEC_T b)
+{
+    const VEC_T product = VEC_MUL(a, b);
+
+#ifdef VEC_FMS
+    return (dd_t){product, VEC_FMS(a, b, product)};
+#else
+    //Split each factor into halves small enough that their products are exact
+    const VEC_T splitter = VEC_SET1(SPLITTER);
+    const VEC_T a_scaled = VEC_MUL(a, splitter);
+    const VEC_T a_hi = VEC_SUB(a_scaled, VEC_SUB(a_scaled, a));
+    const VEC_T a_lo = VEC_SUB(a, a_hi);
+    const VEC_T b_scaled = VEC_MUL(b, splitter);
+    const VEC_T b_hi = VEC_SUB(b_scaled, VEC_SUB(b_scaled, b));
+    const VEC_T b_lo = VEC_SUB(b, b_hi);
+
+    VEC_T error = VEC_SUB(VEC_MUL(a_hi, b_hi), product);
+    error = VEC_ADD(error, VEC_MUL(a_hi, b_lo));
+    error = VEC_ADD(error, VEC_MUL(a_lo, b_hi));
+    error = VEC_ADD(error, VEC_MUL(a_lo, b_lo));
+    return (dd_t){product, error};
+#endif
+}
+
+static ALWAYS_INLINE dd_t dd_add(dd_t a, dd_t b)
+{
+    //The error is relative to |a| + |b| rather than to the result, which is fine since pixels only need absolute precision
+    dd_t sum = two_sum(a.hi, b.hi);
+    sum.lo = VEC_ADD(sum.lo, VEC_ADD(a.lo, b.lo));
+    return quick_two_sum(sum.hi, sum.lo);
+}
+
+static ALWAYS_INLINE dd_t dd_sub(dd_t a, dd_t b)
+{
+    dd_t difference = two_sum(a.hi, VEC_SUB(VEC_SET1(0), b.hi));
+    difference.lo = VEC_ADD(difference.lo, VEC_SUB(a.lo, b.lo));
+    return quick_two_sum(difference.hi, difference.lo);
+}
+
+static ALWAYS_INLINE dd_t dd_mul(dd_t a, dd_t b)
+{
+    dd_t product = two_prod(a.hi, b.hi);
+    product.lo = VEC_ADD(product.lo, VEC_ADD(VEC_MUL(a.hi, b.lo), VEC_MUL(a.lo, b.hi)));
+    return quick_two_sum(product.hi, product.lo);
+}
+
+static ALWAYS_INLINE dd_t dd_sqr(dd_t a)
+{
+    dd_t square = two_prod(a.hi, a.hi);
+    const VEC_T cross = VEC_MUL(a.hi, a.lo);
+    square.lo = VEC_ADD(square.lo, VEC_ADD(cross, cross));
+    return quick_two_sum(square.hi, square.lo);
+}
+
+static ALWAYS_INLINE VEC_T mandelbrot_iterations_dd(dd_t c_real, dd_t c_imag, uint16_t max_iterations)
+{
+    const VEC_T four = VEC_SET1(CONVERGE_VALUE * CONVERGE_VALUE);
+    const VEC_T one = VEC_SET1(1.0);
+
+    dd_t z_real = {VEC_SET1(0), VEC_SET1(0)};
+    dd_t z_imag = {VEC_SET1(0), VEC_SET1(0)};
+    VEC_T count = VEC_SET1(0);
+    MASK_T escaped = MASK_NONE();
+
+    for (uint_fast16_t i = 0; i < max_iterations; ++i)
+    {
+        const dd_t real_squared = dd_sqr(z_real);
+        const dd_t imag_squared = dd_sqr(z_imag);
+
+        //The high parts are plenty to tell whether abs(z) >= CONVERGE_VALUE
+        escaped = MASK_OR(escaped, MASK_GE(VEC_ADD(real_squared.hi, imag_squared.hi), four));
+        if (MASK_BITS(escaped) == ALL_LANES)
+            break;
+        count = VEC_ADD_UNLESS(count, escaped, one);
+
+        //z_(n+1) = z_n^2 + c
+        dd_t product = dd_mul(z_real, z_imag);
+        product.hi = VEC_ADD(product.hi, product.hi);//Doubling is exact
+        product.lo = VEC_ADD(product.lo, product.lo);
+        z_imag = dd_add(product, c_imag);
+        z_real = dd_add(dd_sub(real_squared, imag_squared), c_real);
+    }
+
+    return count;
+}
@@ -0,0 +1,232 @@
+/* Single precision iteration kernels
+ * By: John Jekel
+ *
+ * Like kernels.c, this file is compiled once per instruction set. Floats fit twice as many lanes in each vector as
+ * doubles, which is all zoomed out images (where neighbouring pixels are far apart compared to a float's precision)
+ * need. Pixels are still placed in double precision, and only converted once they're relative to their row
+*/
+
+/* Constants And Defines */
+
+#define CONVERGE_VALUE 2
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+//Number of independent vectors iterated together to hide the latency of each chain's multiplies/adds (see kernels.c)
+#ifdef MBBMP_KERNEL_CHAINS
+#define CHAINS MBBMP_KERNEL_CHAINS
+#else
+#define CHAINS 4
+#endif
+
+//The iteration is written once in terms of these, so only they need defining for each instruction set. Masks track
+//which lanes have escaped; once they have, their z is left to overflow (and may become NaN)
+#if defined(MBBMP_KERNEL_AVX512)
+#define KERNEL_REGION_FLOAT kernel_region_avx512_float
+#define LANES 16
+#define VEC_T __m512
+#define MASK_T __mmask16
+#define VEC_SET1(x) _mm512_set1_ps(x)
+#define VEC_LANE_OFFSETS() _mm512_set_ps(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define VEC_STORE(p, a) _mm512_store_ps(p, a)
+#define VEC_ADD(a, b) _mm512_add_ps(a, b)
+#define VEC_SUB(a, b) _mm512_sub_ps(a, b)
+#define VEC_MUL(a, b) _mm512_mul_ps(a, b)
+#define VEC_MUL_ADD(a, b, c) _mm512_fmadd_ps(a, b, c)
+#define VEC_ADD_UNLESS(a, mask, b) _mm512_mask_add_ps(a, ~(mask), a, b)
+#define VEC_SELECT(mask, a) _mm512_maskz_mov_ps(mask, a)//a where the mask is set, otherwise 0
+#define MASK_LT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define MASK_GE(a, b) _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#define MASK_OR(a, b) ((a) | (b))
+#define MASK_BITS(mask) ((uint64_t)(mask))
+#elif defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2)
+#ifdef MBBMP_KERNEL_AVX2
+#define KERNEL_REGION_FLOAT kernel_region_avx2_float
+#define VEC_MUL_ADD(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define KERNEL_REGION_FLOAT kernel_region_avx_float
+#define VEC_MUL_ADD(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+#define LANES 8
+#define VEC_T __m256
+#define MASK_T __m256
+#define VEC_SET1(x) _mm256_set1_ps(x)
+#define VEC_LANE_OFFSETS() _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0)
+#define VEC_STORE(p, a) _mm256_store_ps(p, a)
+#define VEC_ADD(a, b) _mm256_add_ps(a, b)
+#define VEC_SUB(a, b) _mm256_sub_ps(a, b)
+#define VEC_MUL(a, b) _mm256_mul_ps(a, b)
+#define VEC_ADD_UNLESS(a, mask, b) _mm256_add_ps(a, _mm256_andnot_ps(mask, b))
+#define VEC_SELECT(mask, a) _mm256_and_ps(mask, a)
+#define MASK_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define MASK_GE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define MASK_OR(a, b) _mm256_or_ps(a, b)
+#define MASK_BITS(mask) ((uint64_t) _mm256_movemask_ps(mask))
+#elif defined(MBBMP_KERNEL_SSE2)
+#define KERNEL_REGION_FLOAT kernel_region_sse2_float
+#define LANES 4
+#define VEC_T __m128
+#define MASK_T __m128
+#define VEC_SET1(x) _mm_set1_ps(x)
+#define VEC_LANE_OFFSETS() _mm_set_ps(3, 2, 1, 0)
+#define VEC_STORE(p, a) _mm_store_ps(p, a)
+#define VEC_ADD(a, b) _mm_add_ps(a, b)
+#define VEC_SUB(a, b) _mm_sub_ps(a, b)
+#define VEC_MUL(a, b) _mm_mul_ps(a, b)
+#define VEC_MUL_ADD(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#define VEC_ADD_UNLESS(a, mask, b) _mm_add_ps(a, _mm_andnot_ps(mask, b))
+#define VEC_SELECT(mask, a) _mm_and_ps(mask, a)
+#define MASK_LT(a, b) _mm_cmplt_ps(a, b)
+#define MASK_GE(a, b) _mm_cmpge_ps(a, b)
+#define MASK_OR(a, b) _mm_or_ps(a, b)
+#define MASK_BITS(mask) ((uint64_t) _mm_movemask_ps(mask))
+#else
+#define KERNEL_REGION_FLOAT kernel_region_scalar_float
+#define LANES 1
+#define VEC_T float
+#define MASK_T bool
+#define VEC_SET1(x) ((float)(x))
+#define VEC_LANE_OFFSETS() 0.0f
+#define VEC_STORE(p, a) (*(p) = (a))
+#define VEC_ADD(a, b) ((a) + (b))
+#define VEC_SUB(a, b) ((a) - (b))
+#define VEC_MUL(a, b) ((a) * (b))
+#define VEC_MUL_ADD(a, b, c) (((a) * (b)) + (c))
+#define VEC_ADD_UNLESS(a, mask, b) ((mask) ? (a) : ((a) + (b)))
+#define VEC_SELECT(mask, a) ((mask) ? (a) : 0.0f)
+#define MASK_LT(a, b) ((a) < (b))
+#define MASK_GE(a, b) ((a) >= (b))
+#define MASK_OR(a, b) ((a) || (b))
+#define MASK_BITS(mask) ((uint64_t)(mask))
+#endif
+
+//Each chain's lanes get their own bits of the 64 bit masks of escaped and interior pixels
+_Static_assert((LANES * CHAINS) <= 64, "MBBMP_KERNEL_CHAINS is too high: LANES * CHAINS must be at most 64");
+
+/* Includes */
+
+#include "kernels.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(MBBMP_KERNEL_AVX) || defined(MBBMP_KERNEL_AVX2) || defined(MBBMP_KERNEL_AVX512)
+#include <immintrin.h>
+#elif defined(MBBMP_KERNEL_SSE2)
+#include <xmmintrin.h>
+#endif
+
+/* Static Function Declarations */
+
+static ALWAYS_INLINE uint64_t region_iterate_float(const kernel_region_t* region, uint16_t max_iterations);
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_float(const VEC_T c_real[CHAINS], VEC_T c_imag, float* restrict counts, uint16_t max_iterations);
+
+/* Function Implementations */
+
+uint64_t KERNEL_REGION_FLOAT(const kernel_region_t* region)
+{
+    //Common limits get their own copy of the kernel; anything else goes through the generic one
+    switch (region->max_iterations)
+    {
+        case 255:
+            return region_iterate_float(region, 255);
+        case 1000:
+            return region_iterate_float(region, 1000);
+        case 4096:
+            return region_iterate_float(region, 4096);
+        case 65535:
+            return region_iterate_float(region, 65535);
+        default:
+            return region_iterate_float(region, region->max_iterations);
+    }
+}
+
+/* Static Function Implementations */
+
+static ALWAYS_INLINE uint64_t region_iterate_float(const kernel_region_t* region, uint16_t max_iterations)
+{
+    uint64_t interior_px = 0;
+    const VEC_T lane_offsets = VEC_MUL(VEC_LANE_OFFSETS(), VEC_SET1(region->x_step));
+
+    for (uint64_t j = region->min_y_px; j < region->max_y_px; ++j)
+    {
+        uint16_t* row = kernel_region_row(region, j);
+        const VEC_T imag = VEC_SET1(region->min_y + (j * region->y_step));
+
+        for (uint64_t i = region->min_x_px; i < region->max_x_px; i += LANES * CHAINS)
+        {
+            //The first pixel of each vector is placed in double precision, so the error doesn't grow along the row
+            VEC_T real[CHAINS];
+            for (uint_fast8_t k = 0; k < CHAINS; ++k)
+                real[k] = VEC_ADD(VEC_SET1(region->min_x + ((i + (LANES * k)) * region->x_step)), lane_offsets);
+
+            //Like the other kernels' row tails, the whole group is iterated but only pixels inside the region are kept
+            _Alignas(64) float counts[LANES * CHAINS];
+            const uint64_t interior = mandelbrot_iterations_float(real, imag, counts, max_iterations);
+
+            const uint64_t group_px = ((region->max_x_px - i) < (LANES * CHAINS)) ? (region->max_x_px - i) : (LANES * CHAINS);
+            for (uint64_t k = 0; k < group_px; ++k)
+                row[i + k] = (uint16_t) counts[k];
+            interior_px += __builtin_popcountll(interior & (UINT64_MAX >> (64 - group_px)));
+        }
+    }
+
+    return interior_px;
+}
+
+static ALWAYS_INLINE uint64_t mandelbrot_iterations_float(const VEC_T c_real[CHAINS], VEC_T c_imag, float* restrict counts, uint16_t max_iterations)
+{
+    const VEC_T four = VEC_SET1(CONVERGE_VALUE * CONVERGE_VALUE);
+    const VEC_T one = VEC_SET1(1.0f);
+    const VEC_T quarter = VEC_SET1(0.25f);
+    const VEC_T imag_squared = VEC_MUL(c_imag, c_imag);
+
+    VEC_T z_real[CHAINS], z_imag[CHAINS], count[CHAINS];
+    MASK_T escaped[CHAINS];
+    uint64_t interior = 0;
+
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+    {
+        //Points inside the main cardioid or period-2 bulb (see in_cardioid_or_bulb() in kernels.c) get the limit as
+        //their count, and are treated as having escaped already so the others can finish without them
+        const VEC_T real_shifted = VEC_SUB(c_real[k], quarter);
+        const VEC_T q = VEC_ADD(VEC_MUL(real_shifted, real_shifted), imag_squared);
+        MASK_T inside = MASK_LT(VEC_MUL(q, VEC_ADD(q, real_shifted)), VEC_MUL(imag_squared, quarter));
+        const VEC_T real_plus_one = VEC_ADD(c_real[k], one);
+        inside = MASK_OR(inside, MASK_LT(VEC_ADD(VEC_MUL(real_plus_one, real_plus_one), imag_squared), VEC_SET1(0.0625f)));
+        interior |= MASK_BITS(inside) << (LANES * k);
+
+        z_real[k] = VEC_SET1(0);
+        z_imag[k] = VEC_SET1(0);
+        count[k] = VEC_SELECT(inside, VEC_SET1(max_iterations));
+        escaped[k] = inside;
+    }
+
+    for (uint_fast16_t i = 0; i < max_iterations; ++i)
+    {
+        uint64_t all_escaped = 0;
+
+        for (uint_fast8_t k = 0; k < CHAINS; ++k)
+        {
+            const VEC_T real_squared = VEC_MUL(z_real[k], z_real[k]);
+            const VEC_T imag_squared_z = VEC_MUL(z_imag[k], z_imag[k]);
+
+            //A lane has escaped once abs(z) >= CONVERGE_VALUE, and only counts iterations until then
+            escaped[k] = MASK_OR(escaped[k], MASK_GE(VEC_ADD(real_squared, imag_squared_z), four));
+            all_escaped |= MASK_BITS(escaped[k]) << (LANES * k);
+            count[k] = VEC_ADD_UNLESS(count[k], escaped[k], one);
+
+            //z_(n+1) = z_n^2 + c
+            z_imag[k] = VEC_MUL_ADD(VEC_ADD(z_real[k], z_real[k]), z_imag[k], c_imag);
+            z_real[k] = VEC_ADD(VEC_SUB(real_squared, imag_squared_z), c_real[k]);
+        }
+
+        if (all_escaped == (UINT64_MAX >> (64 - (LANES * CHAINS))))
+            break;
+    }
+
+    for (uint_fast8_t k = 0; k < CHAINS; ++k)
+        VEC_STORE(&counts[LANES * k], count[k]);
+
+    return interior;
+}
@@ -4,576 +4,1146 @@
 
 /* Constants And Defines */
 
-#define ITERATIONS 255//1000
-#define CONVERGE_VALUE 2
-
 #define MBBMP_THREADING
 
+//Intensities are generated in small tiles handed out to the workers, so the expensive (interior) areas get spread out
+#define TILE_WIDTH 64
+#define TILE_HEIGHT 16
+
+//Border tracing (Mariani-Silver) starts from squares this size, and computes rectangles this narrow/short directly
+//rather than subdividing them any further
+#define TRACE_TILE_SIZE 128
+#define TRACE_MIN_SIZE 30
+
+//When tracing, pieces narrower than this are given to the lane refill kernel if the limit is at least this high
+#define TRACE_VECTOR_MIN_WIDTH 16
+#define TRACE_REFILL_MIN_ITERATIONS 1000
+
+//-2 * min_y / y_step must be within this many rows of a whole number for rows to be treated as reflections of each other
+#define MIRROR_TOLERANCE 1e-9
+
+//Render passes are split into bands of whole rows, so each worker reads and writes contiguous memory
+#define RENDER_BAND_HEIGHT 16
+
+//Rows of intensities are padded to a multiple of this many bytes, so every row starts on a cache line and the kernels
+//can use aligned vector stores
+#define INTENSITY_ROW_ALIGNMENT 64
+
 /* Includes */
 
 #include "mandelbrot.h"
 
+#include "kernels.h"
+#include "perturb.h"
+
+#ifdef MBBMP_THREADING
+#include "pool.h"
+#endif
+
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
-#include <complex.h>
 #include <limits.h>
 #include <string.h>
 #include <assert.h>
-
-#ifdef MBBMP_THREADING
-
-#ifdef __STDC_NO_THREADS__
-#error "C11 threading support required for compiling mandelbrot.c"
-#endif
-
-#include <threads.h>
 #include <stdatomic.h>
-#endif
+#include <math.h>
 
 #ifdef __SSE2__
 #include <emmintrin.h>
 #endif
 
-#ifdef __AVX__
-#include <immintrin.h>
-#endif
-
 /* Types */
 
+//Everything the kernels need for one image (besides which pixels to compute), worked out once before generating it
+typedef struct
+{
+    kernel_region_t region;
+    kernel_t kernel;
+    kernel_t refill_kernel;//Keeps its vectors full on narrow pieces (like columns) that the normal kernel would waste lanes on
+} generation_t;
+
+//Everything worked out once per image, which every band of it then shares
+struct mb_generation_state
+{
+    generation_t generation;
+    perturb_reference_t reference;//Only for MB_PRECISION_PERTURB
+    bool mirror;//Whether rows past the real axis can be copied from their reflection
+    uint64_t mirror_sum;//If so, rows j and mirror_sum - j are reflections of each other
+};
+
+//How intensities become pixels, worked out once per render
+typedef struct
+{
+    mb_render_t type;
+    uint16_t max_iterations;
+    uint32_t* colours;//MB_RENDER_COLOUR only: the 3 bytes of each intensity's pixel in file order (lowest byte first)
+    uint8_t* indices;//Palette based renders only: the bitmap palette index of each intensity
+    palette_colour_t bmp_palette[256];
+    uint_fast16_t num_bmp_colours;
+} renderer_t;
+
 #ifdef MBBMP_THREADING
 typedef struct
 {
-    uint8_t thread_num;
-    mb_intensities_t* intensities;
+    const mb_intensities_t* intensities;
+    const generation_t* generation;
+    uint64_t min_y_px, max_y_px;//The rows of the image to generate (max is exclusive)
+    atomic_uint_fast64_t interior_px;
 } intensity_thread_workload_t;
 
 typedef struct
 {
-    uint8_t thread_num;
     bmp_t* render;
+    const renderer_t* renderer;
     const mb_intensities_t* intensities;
 } render_thread_workload_t;
 #endif
 
+//Direct rendering: each job generates a strip of rows into its own scratch intensities, which stay in cache while they
+//are coloured into the bitmap
+typedef struct
+{
+    bmp_t* render;
+    const renderer_t* renderer;
+    const mb_intensities_t* band;//Only its config, generation state and first_row are used (it holds no rows)
+    uint64_t min_y_px, max_y_px;//The rows of the image to render (max is exclusive)
+    uint16_t** strips;//Scratch intensities for each thread, indexed by pool_worker_num()
+    atomic_uint_fast64_t interior_px;
+} direct_workload_t;
+
+typedef struct
+{
+    uint64_t min_x_px, max_x_px;//Includes the border columns (max is exclusive)
+    uint64_t min_y_px, max_y_px;//Rows of the image, including the border rows (max is exclusive)
+} trace_rect_t;
+
+//One level of border tracing: every rectangle in rects is handled by its own job, and any that need subdividing add
+//their children (whose borders are then already computed) to next_rects for the next level
+typedef struct
+{
+    mb_intensities_t* intensities;
+    const generation_t* generation;
+    bool borders_done;//False for the first level, where the rectangles are tiles that haven't been computed at all
+
+    const trace_rect_t* rects;
+    trace_rect_t* next_rects;
+    atomic_uint_fast32_t num_next_rects;
+
+    atomic_uint_fast64_t interior_px;
+    atomic_uint_fast64_t filled_px;
+} trace_workload_t;
+
 /* Variables */
 
-#ifdef MBBMP_THREADING
-static uint16_t max_threads = 1;
-static uint16_t processing_chunks = 4;//So that CPUs aren't just left sitting around
-static atomic_ushort current_threads = 0;
+//Kernels from best to worst; the first one the CPU supports is used unless one is chosen with mb_set_kernel()
+static const struct
+{
+    const char* name;
+    kernel_t kernel;
+    kernel_t refill_kernel;
+    kernel_t perturb_kernel;
+    kernel_t dd_kernel;
+    kernel_t float_kernel;
+} kernels_table[] =
+{
+#if MBBMP_X86
+    {"avx512", kernel_region_avx512, kernel_region_avx512_refill, kernel_region_avx512_perturb, kernel_region_avx512_dd, kernel_region_avx512_float},
+    {"avx2", kernel_region_avx2, kernel_region_avx2_refill, kernel_region_avx2_perturb, kernel_region_avx2_dd, kernel_region_avx2_float},
+    {"avx", kernel_region_avx, kernel_region_avx_refill, kernel_region_avx_perturb, kernel_region_avx_dd, kernel_region_avx_float},
+    {"sse2", kernel_region_sse2, kernel_region_sse2_refill, kernel_region_sse2_perturb, kernel_region_sse2_dd, kernel_region_sse2_float},
 #endif
+    {"scalar", kernel_region_scalar, kernel_region_scalar, kernel_region_scalar_perturb, kernel_region_scalar_dd, kernel_region_scalar_float}//Only one lane, so there is nothing to refill
+};
+#define NUM_KERNELS (sizeof(kernels_table) / sizeof(kernels_table[0]))
+
+static size_t chosen_kernel = NUM_KERNELS;//NUM_KERNELS means pick automatically
+static bool lane_refill = false;
+static bool border_tracing = false;
+static bool mirroring = true;
+
+//Indexed by mb_precision_t
+static const char* const precision_names[] = {"float", "double", "dd", "perturb"};
+#define NUM_PRECISIONS (sizeof(precision_names) / sizeof(precision_names[0]))
+static size_t chosen_precision = NUM_PRECISIONS;//NUM_PRECISIONS means pick automatically for each image
+
+static const palette_t* chosen_palette = NULL;//NULL means the built in default for each render type
 
 /* Static Function Declarations */
 
-static uint16_t mandelbrot_iterations_basic(complex double c);
+static bool kernel_supported(size_t kernel_num);
+static size_t active_kernel_num(void);
+static kernel_t active_kernel(void);
+static void init_generation(generation_t* generation, const mb_intensities_t* intensities, const perturb_reference_t* reference);
 
-#ifdef __SSE2__
-static __m128i mandelbrot_iterations_sse2_2(__m128d c_real, __m128d c_imag);
-#endif
+static inline uint16_t* intensities_row(const mb_intensities_t* intensities, uint64_t j);
+static bool find_mirror_sum(const mb_config_t* config, uint64_t* mirror_sum);
+static void generate_rows(mb_intensities_t* intensities, const generation_t* generation, uint64_t min_y_px, uint64_t max_y_px);
+static void generate_intensities_traced(mb_intensities_t* intensities, const generation_t* generation, uint64_t min_y_px, uint64_t max_y_px);
+static void trace_rect(void* workload_, uint32_t rect_num);
+static uint64_t trace_compute(trace_workload_t* workload, uint64_t min_x_px, uint64_t max_x_px, uint64_t min_y_px, uint64_t max_y_px);
+static bool trace_border_uniform(const mb_intensities_t* intensities, const trace_rect_t* rect);
 
-#ifdef __AVX__
-static __m256i mandelbrot_iterations_avx_4(__m256d c_real, __m256d c_imag);//This is also for avx2
-#endif
+static void mirrored_rows(const struct mb_generation_state* state, uint64_t first_row, uint64_t end_row, uint64_t* first_mirrored_row, uint64_t* end_mirrored_rows);
 
 static void intensities_render_normal_8(bmp_t* restrict render, const mb_intensities_t* restrict intensities);//TODO implement
-static void intensities_render_inverted_8(bmp_t* restrict render, const mb_intensities_t* restrict intensities);//More iterations = darker colour
+static void render_init(bmp_t* restrict render, const renderer_t* restrict renderer, uint64_t width, uint64_t height, uint8_t* restrict image_data);
+static void renderer_init(renderer_t* renderer, mb_render_t type, uint16_t max_iterations);
+static void renderer_destroy(renderer_t* renderer);
+static void render_intensities_rows(bmp_t* restrict render, const renderer_t* restrict renderer, const mb_intensities_t* restrict intensities, uint64_t min_y_px, uint64_t max_y_px);
+static void colour_row(bmp_t* restrict render, const renderer_t* restrict renderer, uint64_t y, const uint16_t* restrict row, uint64_t x_pixels);
+static void colour_row_bw(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, uint64_t row_len_bytes, uint16_t max_iterations);
+static void colour_row_4(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, uint64_t row_len_bytes, const uint8_t* restrict indices);
+static void colour_row_8(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, const uint8_t* restrict indices);
+static void colour_row_24(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, uint64_t row_len_bytes, const uint32_t* restrict colours);
+static inline void store_le32(uint8_t* destination, uint32_t value);
+static bool render_direct_rows(bmp_t* restrict render, const renderer_t* restrict renderer, mb_intensities_t* restrict band, uint64_t min_y_px, uint64_t max_y_px);
+static void render_direct_strip(void* workload_, uint32_t strip_num);
 
 #ifdef MBBMP_THREADING
-static int intensities_render_inverted_8_thread(void* workload_);
-static int generate_intensities_threaded(void* workload_);
+static void render_intensities_thread(void* workload_, uint32_t band_num);
+static void generate_intensities_threaded(void* workload_, uint32_t tile_num);
 #endif
 
 /* Function Implementations */
 
-void mb_set_total_active_threads(uint16_t threads)
+bool mb_set_kernel(const char* name)
 {
-    assert(threads > 0);
-#ifdef MBBMP_THREADING
-    max_threads = threads;
-    processing_chunks = threads * 4;//So that CPUs aren't just left sitting around
-#endif
+    if (!strcmp(name, "auto"))
+    {
+        chosen_kernel = NUM_KERNELS;
+        return true;
+    }
+
+    for (size_t i = 0; i < NUM_KERNELS; ++i)
+    {
+        if (!strcmp(kernels_table[i].name, name))
+        {
+            if (!kernel_supported(i))
+                return false;
+
+            chosen_kernel = i;
+            return true;
+        }
+    }
+
+    return false;//No kernel with that name
 }
 
-mb_intensities_t* mb_generate_intensities(const mb_config_t* restrict config)
+const char* mb_get_kernel(void)
 {
-    mb_intensities_t* restrict intensities = (mb_intensities_t*) malloc(sizeof(mb_config_t) + (sizeof(uint16_t) * config->x_pixels * config->y_pixels));
-    memcpy(&intensities->config, config, sizeof(mb_config_t));
+    return kernels_table[active_kernel_num()].name;
+}
 
-#ifdef MBBMP_THREADING
-    thrd_t threads[processing_chunks];
-    intensity_thread_workload_t workloads[processing_chunks];
+void mb_set_lane_refill(bool enabled)
+{
+    lane_refill = enabled;
+}
 
-    for (uint8_t i = 0; i < processing_chunks; ++i)
-    {
-        //Wait for our time to begin
-        while (current_threads >= max_threads)
-            thrd_yield();
-        ++current_threads;//It's okay if we're not atomic with this comparison after the above since we only increment it here
+void mb_set_border_tracing(bool enabled)
+{
+    border_tracing = enabled;
+}
 
-        workloads[i].thread_num = i;
-        workloads[i].intensities = intensities;
-        thrd_create(&threads[i], generate_intensities_threaded, (void*)&workloads[i]);
-    }
+bool mb_get_border_tracing(void)
+{
+    return border_tracing;
+}
+
+void mb_set_mirroring(bool enabled)
+{
+    mirroring = enabled;
+}
 
-    for (uint8_t i = 0; i < processing_chunks; ++i)
+bool mb_set_precision(const char* name)
+{
+    if (!strcmp(name, "auto"))
     {
-        thrd_join(threads[i], NULL);
+        chosen_precision = NUM_PRECISIONS;
+        return true;
     }
-#else
-    const double x_step = (config->max_x - config->min_x) / config->x_pixels;
-    const double y_step = (config->max_y - config->min_y) / config->y_pixels;
-
-    double x = config->min_x;
-
-    //TODO use vectorization despite not having threading
 
-    for (uint16_t i = 0; i < config->x_pixels; ++i)
+    for (size_t i = 0; i < NUM_PRECISIONS; ++i)
     {
-        double y = config->min_y;
-        for (uint16_t j = 0; j < config->y_pixels; ++j)
+        if (!strcmp(precision_names[i], name))
         {
-            intensities->intensities[i + (j * config->x_pixels)] = mandelbrot_iterations_basic(CMPLXF(x, y));
-            y += y_step;
+            chosen_precision = i;
+            return true;
         }
-
-        x += x_step;
     }
+
+    return false;
+}
+
+void mb_set_palette(const palette_t* palette)
+{
+    chosen_palette = palette;
+}
+
+void mb_set_total_active_threads(uint16_t threads)
+{
+    assert(threads > 0);
+#ifdef MBBMP_THREADING
+    pool_set_threads(threads);//Workers are kept around between passes instead of being created each time
 #endif
+}
 
+mb_intensities_t* mb_generate_intensities(const mb_config_t* restrict config)
+{
+    mb_intensities_t* intensities = mb_create_band(config, config->y_pixels);
+    if (intensities)
+        mb_generate_band(intensities, 0, config->y_pixels);
     return intensities;
 }
 
 void mb_destroy_intensities(mb_intensities_t* restrict intensities)
 {
+    if (intensities->precision == MB_PRECISION_PERTURB)
+        perturb_reference_destroy(&intensities->state->reference);
+
+    free(intensities->state);
     free(intensities);
 }
 
-void mb_render_bw(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+mb_intensities_t* mb_create_band(const mb_config_t* restrict config, uint64_t max_rows)
 {
-    bmp_create(bitmap_to_init, intensities->config.x_pixels, intensities->config.y_pixels, BPP_1);
-    bmp_palette_set_size(bitmap_to_init, 2);
-    bmp_palette_colour_set(bitmap_to_init, 0, (palette_colour_t){.r = 0, .g = 0, .b = 0, .a = 0});
-    bmp_palette_colour_set(bitmap_to_init, 1, (palette_colour_t){.r = 0xFF, .g = 0xFF, .b = 0xFF, .a = 0});
+    //Pad each row out to a whole number of cache lines (aligned_alloc() also needs the size to be a multiple of the alignment)
+    const uint64_t row_stride = ((config->x_pixels * sizeof(uint16_t)) + INTENSITY_ROW_ALIGNMENT - 1) / INTENSITY_ROW_ALIGNMENT * (INTENSITY_ROW_ALIGNMENT / sizeof(uint16_t));
+    size_t size = sizeof(mb_intensities_t) + (sizeof(uint16_t) * row_stride * max_rows);
+    size = (size + INTENSITY_ROW_ALIGNMENT - 1) / INTENSITY_ROW_ALIGNMENT * INTENSITY_ROW_ALIGNMENT;
+
+    mb_intensities_t* restrict intensities = (mb_intensities_t*) aligned_alloc(INTENSITY_ROW_ALIGNMENT, size);
+    if (!intensities)
+        return NULL;
+    memcpy(&intensities->config, config, sizeof(mb_config_t));
+    intensities->row_stride = row_stride;
+    intensities->interior_px = 0;
+    intensities->filled_px = 0;
+    intensities->mirrored_px = 0;
+    intensities->first_row = 0;
+    intensities->num_rows = 0;
+    intensities->max_rows = max_rows;
+    intensities->precision = (chosen_precision == NUM_PRECISIONS) ? perturb_precision_needed(config) : (mb_precision_t) chosen_precision;
+    if ((chosen_precision == NUM_PRECISIONS) && (intensities->precision == MB_PRECISION_FLOAT) && lane_refill)
+        intensities->precision = MB_PRECISION_DOUBLE;//Only the double kernels can refill lanes
+
+    struct mb_generation_state* state = (struct mb_generation_state*) malloc(sizeof(struct mb_generation_state));
+    if (!state)
+    {
+        free(intensities);
+        return NULL;
+    }
+    intensities->state = state;
 
-    //TODO make this faster/multithreaded/vectorize
-    for (uint16_t i = 0; i < intensities->config.x_pixels; ++i)
+    //Deep zooms are iterated relative to the orbit of the centre, computed to high precision beforehand (mirroring isn't
+    //tried for these or double-double since the doubles in config aren't precise enough to tell which rows line up)
+    if (intensities->precision == MB_PRECISION_PERTURB)
     {
-        for (uint16_t j = 0; j < intensities->config.y_pixels; ++j)
-        {
-            uint32_t value = (intensities->intensities[i + (j * intensities->config.x_pixels)] == ITERATIONS) ? 0 : 1;
+        perturb_reference_create(&state->reference, config);
+        init_generation(&state->generation, intensities, &state->reference);
+    }
+    else
+        init_generation(&state->generation, intensities, NULL);
 
-            bmp_px_set_1(bitmap_to_init, i, j, value);
-        }
+    state->mirror = mirroring && (intensities->precision <= MB_PRECISION_DOUBLE) && find_mirror_sum(config, &state->mirror_sum);
+    return intensities;
+}
+
+void mb_generate_band(mb_intensities_t* restrict band, uint64_t first_row, uint64_t num_rows)
+{
+    assert(num_rows <= band->max_rows);
+    assert((first_row + num_rows) <= band->config.y_pixels);
+
+    struct mb_generation_state* state = band->state;
+    band->first_row = first_row;
+    band->num_rows = num_rows;
+    state->generation.region.first_row = first_row;
+
+    //Rows past the real axis whose reflection is also in the band are copied from it rather than computed
+    const uint64_t end_row = first_row + num_rows;
+    uint64_t first_mirrored_row, end_mirrored_rows;
+    mirrored_rows(state, first_row, end_row, &first_mirrored_row, &end_mirrored_rows);
+
+    generate_rows(band, &state->generation, first_row, first_mirrored_row);
+    generate_rows(band, &state->generation, end_mirrored_rows, end_row);//Rows past the reflection of the first one (if any)
+
+    for (uint64_t j = first_mirrored_row; j < end_mirrored_rows; ++j)
+    {
+        memcpy(intensities_row(band, j), intensities_row(band, state->mirror_sum - j), sizeof(uint16_t) * band->row_stride);
     }
+    band->mirrored_px += (end_mirrored_rows - first_mirrored_row) * band->config.x_pixels;
 }
 
-void mb_render_grey_8(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+bpp_t mb_render_bpp(mb_render_t type)
 {
-    bmp_create(bitmap_to_init, intensities->config.x_pixels, intensities->config.y_pixels, BPP_8);
-    bmp_palette_set_size(bitmap_to_init, 256);
+    switch (type)
+    {
+        case MB_RENDER_BW:
+            return BPP_1;
+        case MB_RENDER_GREY_4:
+        case MB_RENDER_COLOUR_4:
+            return BPP_4;
+        case MB_RENDER_GREY_8:
+        case MB_RENDER_COLOUR_8:
+            return BPP_8;
+        default:
+            return BPP_24;
+    }
+}
+
+void mb_render(const mb_intensities_t* restrict intensities, mb_render_t type, bmp_t* restrict bitmap_to_init, uint8_t* restrict image_data)
+{
+    renderer_t renderer;
+    renderer_init(&renderer, type, intensities->config.max_iterations);
+    render_init(bitmap_to_init, &renderer, intensities->config.x_pixels, intensities->num_rows, image_data);
+
+#ifdef MBBMP_THREADING
+    render_thread_workload_t workload = {.render = bitmap_to_init, .renderer = &renderer, .intensities = intensities};
+    pool_run(render_intensities_thread, (void*)&workload, (intensities->num_rows + RENDER_BAND_HEIGHT - 1) / RENDER_BAND_HEIGHT);
+#else
+    render_intensities_rows(bitmap_to_init, &renderer, intensities, 0, intensities->num_rows);
+#endif
 
-    //Simple pallete (maps index to brightness)
-    for (uint16_t i = 0; i < 256; ++i)
-        bmp_palette_colour_set(bitmap_to_init, i, (palette_colour_t) {.r = i, .g = i, .b = i, .a = 0});
+    renderer_destroy(&renderer);
+}
 
-    intensities_render_inverted_8(bitmap_to_init, intensities);
+void mb_render_bw(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+{
+    mb_render(intensities, MB_RENDER_BW, bitmap_to_init, NULL);
+}
+
+void mb_render_grey_8(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+{
+    mb_render(intensities, MB_RENDER_GREY_8, bitmap_to_init, NULL);
 }
 
 void mb_render_colour(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
 {
-    bmp_create(bitmap_to_init, intensities->config.x_pixels, intensities->config.y_pixels, BPP_24);
+    mb_render(intensities, MB_RENDER_COLOUR, bitmap_to_init, NULL);
+}
+
+void mb_render_colour_8(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+{
+    mb_render(intensities, MB_RENDER_COLOUR_8, bitmap_to_init, NULL);
+}
 
-    //TODO make this faster/multithreaded/vectorize
-    for (uint16_t i = 0; i < intensities->config.x_pixels; ++i)
-    {
-        for (uint16_t j = 0; j < intensities->config.y_pixels; ++j)
-        {
-            uint32_t value;
-            uint32_t intensity = intensities->intensities[i + (j * intensities->config.x_pixels)];
+void mb_render_grey_4(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+{
+    mb_render(intensities, MB_RENDER_GREY_4, bitmap_to_init, NULL);
+}
 
-            if (intensity == ITERATIONS)
-                value = 0;
-            else
-            {
-                switch (intensity % 3)
-                {
-                    case 0:
-                        value = (intensity % 128) << 1;
-                        break;
-                    case 1:
-                        value = (intensity % 128) << 9;
-                        break;
-                    case 2:
-                        value = (intensity % 128) << 17;
-                        break;
-                }
-            }
+void mb_render_colour_4(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+{
+    mb_render(intensities, MB_RENDER_COLOUR_4, bitmap_to_init, NULL);
+}
 
-            bmp_px_set_24(bitmap_to_init, i, j, value);
-        }
-    }
+bool mb_render_direct(const mb_config_t* restrict config, mb_render_t type, bmp_t* restrict bitmap_to_init)
+{
+    mb_intensities_t* band = mb_create_band(config, 0);
+    if (!band)
+        return false;
+
+    const bool success = mb_render_band_direct(band, 0, config->y_pixels, type, bitmap_to_init, NULL);
+    mb_destroy_intensities(band);
+    if (!success)
+        bmp_destroy(bitmap_to_init);
+    return success;
 }
 
-void mb_render_colour_8(const mb_intensities_t* restrict intensities, bmp_t* restrict bitmap_to_init)
+bool mb_render_band_direct(mb_intensities_t* restrict band, uint64_t first_row, uint64_t num_rows, mb_render_t type, bmp_t* restrict bitmap_to_init, uint8_t* restrict image_data)
 {
-    bmp_create(bitmap_to_init, intensities->config.x_pixels, intensities->config.y_pixels, BPP_8);
-    bmp_palette_set_size(bitmap_to_init, 256);
+    assert((first_row + num_rows) <= band->config.y_pixels);
 
-    //Simple pallete (maps index to brightness)
-    bmp_palette_colour_set(bitmap_to_init, 0, (palette_colour_t){.r = 0, .g = 0, .b = 0, .a = 0});//Special case: Non converge produces zero
-    for (uint16_t i = 1; i < 256; ++i)
-    {
-        palette_colour_t colour = {.r = 0, .g = 0, .b = 0, .a = 0};
+    band->first_row = first_row;
+    band->num_rows = 0;//None of them are kept
 
-        const uint8_t max_iterations = 255;
-        const uint8_t band_range = max_iterations / 11;
+    renderer_t renderer;
+    renderer_init(&renderer, type, band->config.max_iterations);
+    render_init(bitmap_to_init, &renderer, band->config.x_pixels, num_rows, image_data);
 
-        if (i < band_range)
-        {
-            colour.r = i;
-        }
-        else if (i < (2 * band_range))
-        {
-            colour.r = i;
-            colour.g = i / 2;
-        }
-        else if (i < (3 * band_range))
-        {
-            colour.r = i;
-            colour.g = i;
-        }
-        else if (i < (4 * band_range))
-        {
-            colour.r = i / 2;
-            colour.g = i;
-        }
-        else if (i < (5 * band_range))
-        {
-            colour.g = i;
-        }
-        else if (i < (6 * band_range))
-        {
-            colour.g = i;
-            colour.b = i / 2;
-        }
-        else if (i < (7 * band_range))
-        {
-            colour.g = i;
-            colour.b = i;
-        }
-        else if (i < (8 * band_range))
-        {
-            colour.g = i / 2;
-            colour.b = i;
-        }
-        else if (i < (9 * band_range))
-        {
-            colour.b = i;
-        }
-        else if (i < (10 * band_range))
-        {
-            colour.r = i / 2;
-            colour.b = i;
-        }
-        else
-        {
-            colour.r = i;
-            colour.b = i;
-        }
+    //Same as mb_generate_band(), except that mirrored rows are copied from the finished bitmap rows instead
+    const uint64_t end_row = first_row + num_rows;
+    uint64_t first_mirrored_row, end_mirrored_rows;
+    mirrored_rows(band->state, first_row, end_row, &first_mirrored_row, &end_mirrored_rows);
 
-        bmp_palette_colour_set(bitmap_to_init, i, colour);
-    }
+    const bool success = render_direct_rows(bitmap_to_init, &renderer, band, first_row, first_mirrored_row) && render_direct_rows(bitmap_to_init, &renderer, band, end_mirrored_rows, end_row);
+    renderer_destroy(&renderer);
+    if (!success)
+        return false;
 
-    intensities_render_inverted_8(bitmap_to_init, intensities);
+    for (uint64_t j = first_mirrored_row; j < end_mirrored_rows; ++j)
+    {
+        memcpy(&bitmap_to_init->image_data_b[(j - first_row) * bitmap_to_init->row_len_bytes], &bitmap_to_init->image_data_b[(band->state->mirror_sum - j - first_row) * bitmap_to_init->row_len_bytes], bitmap_to_init->row_len_bytes);
+    }
+    band->mirrored_px += (end_mirrored_rows - first_mirrored_row) * band->config.x_pixels;
+    return true;
 }
 
 /* Static Function Implementations */
 
-static uint16_t mandelbrot_iterations_basic(complex double c)
+static void render_init(bmp_t* restrict render, const renderer_t* restrict renderer, uint64_t width, uint64_t height, uint8_t* restrict image_data)
 {
-    complex double z = 0;//z_0 = 0
+    const bpp_t bpp = mb_render_bpp(renderer->type);
+    if (image_data)
+        bmp_create_in(render, width, height, bpp, image_data);
+    else
+        bmp_create(render, width, height, bpp);
 
-    for (uint_fast16_t i = 0; i < ITERATIONS; ++i)
+    if (renderer->type == MB_RENDER_BW)
     {
-        double real = creal(z);
-        double imag = cimag(z);
+        bmp_palette_set_size(render, 2);
+        bmp_palette_colour_set(render, 0, (palette_colour_t){.r = 0, .g = 0, .b = 0, .a = 0});
+        bmp_palette_colour_set(render, 1, (palette_colour_t){.r = 0xFF, .g = 0xFF, .b = 0xFF, .a = 0});
+    }
+    else if (renderer->num_bmp_colours)//Palette based
+    {
+        bmp_palette_set_size(render, renderer->num_bmp_colours);
+        for (uint_fast16_t i = 0; i < renderer->num_bmp_colours; ++i)
+            bmp_palette_colour_set(render, i, renderer->bmp_palette[i]);
+    }
+}
 
-        if (((real * real) + (imag * imag)) >= (CONVERGE_VALUE * CONVERGE_VALUE))//Check if abs(z) >= CONVERGE_VALUE
-            return i;
+static void renderer_init(renderer_t* renderer, mb_render_t type, uint16_t max_iterations)
+{
+    renderer->type = type;
+    renderer->max_iterations = max_iterations;
+    renderer->colours = NULL;
+    renderer->indices = NULL;
+    renderer->num_bmp_colours = 0;
+
+    if (type == MB_RENDER_BW)
+        return;
+
+    //Grey renders always use the grey palette; the colour ones use the chosen one if there is one
+    palette_t builtin;
+    const palette_t* palette = chosen_palette;
+    const bool grey = (type == MB_RENDER_GREY_8) || (type == MB_RENDER_GREY_4);
+    if (grey || !palette)
+    {
+        palette_builtin(&builtin, grey ? "grey" : ((type == MB_RENDER_COLOUR) ? "rgb" : "bands"));
+        palette = &builtin;
+    }
 
-        z = (z * z) + c;//z_(n+1) = z_n^2 + c
+    //Every intensity the kernels can produce gets its colour worked out once, rather than once per pixel
+    if (type == MB_RENDER_COLOUR)
+    {
+        renderer->colours = (uint32_t*) malloc(sizeof(uint32_t) * ((size_t) max_iterations + 1));
+        palette_compile_24(palette, max_iterations, renderer->colours);
+    }
+    else
+    {
+        const bool four_bit = (type == MB_RENDER_GREY_4) || (type == MB_RENDER_COLOUR_4);
+        renderer->indices = (uint8_t*) malloc((size_t) max_iterations + 1);
+        renderer->num_bmp_colours = palette_compile_indexed(palette, max_iterations, renderer->indices, renderer->bmp_palette, four_bit ? 16 : 256);
     }
 
-    return ITERATIONS;//Failed to converge within ITERATIONS iterations
+    if (palette == &builtin)
+        palette_destroy(&builtin);
 }
 
-#ifdef __SSE2__
-static __m128i mandelbrot_iterations_sse2_2(__m128d c_real, __m128d c_imag)
+static void renderer_destroy(renderer_t* renderer)
 {
-    const __m128d four = _mm_set_pd1(4.0);
-    const __m128d two = _mm_set_pd1(2.0);
-    const __m128i one_i = _mm_set1_epi64x(1);
+    free(renderer->colours);
+    free(renderer->indices);
+}
 
-    __m128i result = _mm_set1_epi64x(0);
+static void render_intensities_rows(bmp_t* restrict render, const renderer_t* restrict renderer, const mb_intensities_t* restrict intensities, uint64_t min_y_px, uint64_t max_y_px)
+{
+    for (uint64_t j = min_y_px; j < max_y_px; ++j)
+        colour_row(render, renderer, j, &intensities->intensities[j * intensities->row_stride], intensities->config.x_pixels);
+}
 
-    __m128d z_real = _mm_set_pd1(0);
-    __m128d z_imag = _mm_set_pd1(0);
-    for (uint_fast16_t i = 0; i < ITERATIONS; ++i)
-    {
-        //Calculate some values that are used below
-        __m128d z_real_squared = _mm_mul_pd(z_real, z_real);
-        __m128d z_imag_squared = _mm_mul_pd(z_imag, z_imag);
+#ifdef MBBMP_THREADING
+static void render_intensities_thread(void* workload_, uint32_t band_num)
+{
+    render_thread_workload_t* workload = (render_thread_workload_t*) workload_;
+    const uint64_t num_rows = workload->intensities->num_rows;
 
-        //Check if the modulus of each z < the converge value of 2 (aka that they have converged)
-        //We do this faster by doing (z_real * z_real) + (z_imag * z_imag) < (2 * 2)
-        __m128d squared_sum = _mm_add_pd(z_real_squared, z_imag_squared);
-        __m128i compare = _mm_castpd_si128(_mm_cmplt_pd(squared_sum, four));
+    //The last band is clipped to the bottom of the intensities
+    const uint64_t min_y_px = (uint64_t) band_num * RENDER_BAND_HEIGHT;
+    const uint64_t max_y_px = ((num_rows - min_y_px) < RENDER_BAND_HEIGHT) ? num_rows : (min_y_px + RENDER_BAND_HEIGHT);
+    render_intensities_rows(workload->render, workload->renderer, workload->intensities, min_y_px, max_y_px);
+}
+#endif
+
+static void colour_row(bmp_t* restrict render, const renderer_t* restrict renderer, uint64_t y, const uint16_t* restrict row, uint64_t x_pixels)
+{
+    uint8_t* restrict render_row = &render->image_data_b[y * render->row_len_bytes];
+    const uint32_t max_iterations = renderer->max_iterations;
 
-        //If both complex numbers have converged (entire vector is 0), return early
-        bool at_least_one_not_converged = (bool)_mm_movemask_epi8(compare);
-        if (!at_least_one_not_converged)
+    switch (renderer->type)
+    {
+        case MB_RENDER_BW:
+            colour_row_bw(render_row, row, x_pixels, render->row_len_bytes, max_iterations);
+            break;
+        case MB_RENDER_GREY_8:
+        case MB_RENDER_COLOUR_8:
+            colour_row_8(render_row, row, x_pixels, renderer->indices);
+            break;
+        case MB_RENDER_GREY_4:
+        case MB_RENDER_COLOUR_4:
+            colour_row_4(render_row, row, x_pixels, render->row_len_bytes, renderer->indices);
             break;
+        case MB_RENDER_COLOUR:
+            colour_row_24(render_row, row, x_pixels, render->row_len_bytes, renderer->colours);
+            break;
+    }
+}
+
+static void colour_row_bw(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, uint64_t row_len_bytes, uint16_t max_iterations)
+{
+    //Pixels in the set are black (0) and the rest white (1); the first pixel of each byte is its most significant bit.
+    //Whole bytes are written, so nothing depends on what the bitmap held before
+    uint64_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i limit = _mm_set1_epi16((int16_t) max_iterations);
+    for (; (i + 16) <= x_pixels; i += 16)
+    {
+        __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) &row[i]), limit);
+        __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) &row[i + 8]), limit);
 
-        //Get next entries (For each complex number z, z_(n+1) = z_n^2 + c)
-        __m128d temp_zreal = _mm_add_pd(_mm_sub_pd(z_real_squared, z_imag_squared), c_real);
-        z_imag = _mm_add_pd(c_imag, _mm_mul_pd(two, _mm_mul_pd(z_real, z_imag)));
-        z_real = temp_zreal;
+        //Reverse the order of each vector's 8 pixels so that after packing, bit 7 of each byte of the movemask is the
+        //first of its 8 pixels
+        low = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(low, 0x1B), 0x1B), 0x4E);
+        high = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(high, 0x1B), 0x1B), 0x4E);
+        const uint32_t in_set = (uint32_t) _mm_movemask_epi8(_mm_packs_epi16(low, high));
 
-        //Increment the corresponding count only if we haven't converged yet
-        __m128i incrementor = _mm_and_si128(compare, one_i);//If a number hasn't converged, we will increment it's count
-        result = _mm_add_epi64(result, incrementor);
+        render_row[i / 8] = (uint8_t) ~in_set;
+        render_row[(i / 8) + 1] = (uint8_t) ~(in_set >> 8);
+    }
+#endif
+
+    //The rest a byte at a time, leaving the unused bits of the last one 0
+    for (; i < x_pixels; i += 8)
+    {
+        uint8_t byte = 0;
+        for (uint_fast8_t k = 0; (k < 8) && ((i + k) < x_pixels); ++k)
+            byte |= (uint8_t)((row[i + k] != max_iterations) << (7 - k));
+        render_row[i / 8] = byte;
     }
 
-    //Pack the 64 bit values into the lower 32 bits (16 bits each)
-    result = _mm_shuffle_epi32(result, _MM_SHUFFLE(0, 2, 0, 0));//TODO how does this work?
-    return result;
+    //Zero the padding out to the end of the row too
+    const uint64_t used_bytes = (x_pixels + 7) / 8;
+    memset(&render_row[used_bytes], 0, row_len_bytes - used_bytes);
 }
-#endif
 
-#ifdef __AVX__
-static __m256i mandelbrot_iterations_avx_4(__m256d c_real, __m256d c_imag)
+static void colour_row_4(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, uint64_t row_len_bytes, const uint8_t* restrict indices)
 {
-    const __m256d four = _mm256_set1_pd(4.0);
-    const __m256d two = _mm256_set1_pd(2.0);
-    const __m256i one_i = _mm256_set1_epi64x(1);
-
-    __m256i result = _mm256_set1_epi64x(0);
+    //Same packing as bmp_px_set_4(): the first pixel of each byte is its upper nibble. Whole bytes are written, so
+    //nothing depends on what the bitmap held before
+    uint64_t i = 0;
+    for (; (i + 2) <= x_pixels; i += 2)
+        render_row[i / 2] = (indices[row[i]] << 4) | indices[row[i + 1]];
+
+    uint64_t byte = i / 2;
+    if (i < x_pixels)//Odd width
+    {
+        render_row[byte] = indices[row[i]] << 4;
+        ++byte;
+    }
 
-    __m256d z_real = _mm256_set1_pd(0);
-    __m256d z_imag = _mm256_set1_pd(0);
+    memset(&render_row[byte], 0, row_len_bytes - byte);
+}
 
-    for (uint_fast16_t i = 0; i < ITERATIONS; ++i)
+static void colour_row_8(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, const uint8_t* restrict indices)
+{
+    //There are no byte gathers to vectorize this with, so it is unrolled to keep several independent loads in flight
+    uint64_t i = 0;
+    for (; (i + 4) <= x_pixels; i += 4)
     {
-        //Calculate some values that are used below
-        __m256d z_real_squared = _mm256_mul_pd(z_real, z_real);
-        __m256d z_imag_squared = _mm256_mul_pd(z_imag, z_imag);
+        const uint8_t a = indices[row[i]];
+        const uint8_t b = indices[row[i + 1]];
+        const uint8_t c = indices[row[i + 2]];
+        const uint8_t d = indices[row[i + 3]];
+        render_row[i] = a;
+        render_row[i + 1] = b;
+        render_row[i + 2] = c;
+        render_row[i + 3] = d;
+    }
 
-        //Check if the modulus of each z < the converge value of 2 (aka that they have converged)
-        //We do this faster by doing (z_real * z_real) + (z_imag * z_imag) < (2 * 2)
-        __m256d squared_sum = _mm256_add_pd(z_real_squared, z_imag_squared);
-        __m256d compare = _mm256_cmp_pd(squared_sum, four, _CMP_LT_OQ);
+    for (; i < x_pixels; ++i)
+        render_row[i] = indices[row[i]];
+}
 
-        //If both complex numbers have converged (entire vector is 0), return early
-        bool at_least_one_not_converged = (bool)_mm256_movemask_pd(compare);
-        if (!at_least_one_not_converged)
-            break;
+static void colour_row_24(uint8_t* restrict render_row, const uint16_t* restrict row, uint64_t x_pixels, uint64_t row_len_bytes, const uint32_t* restrict colours)
+{
+    //4 pixels' BGR triplets are shifted together into 3 whole words, so there are 3 stores for them instead of 12
+    uint64_t i = 0;
+    for (; (i + 4) <= x_pixels; i += 4)
+    {
+        const uint32_t pixel_0 = colours[row[i]];
+        const uint32_t pixel_1 = colours[row[i + 1]];
+        const uint32_t pixel_2 = colours[row[i + 2]];
+        const uint32_t pixel_3 = colours[row[i + 3]];
+
+        uint8_t* destination = &render_row[i * 3];
+        store_le32(destination, pixel_0 | (pixel_1 << 24));
+        store_le32(destination + 4, (pixel_1 >> 8) | (pixel_2 << 16));
+        store_le32(destination + 8, (pixel_2 >> 16) | (pixel_3 << 8));
+    }
 
-        //Get next entries (For each complex number z, z_(n+1) = z_n^2 + c)
-        __m256d temp_zreal = _mm256_add_pd(_mm256_sub_pd(z_real_squared, z_imag_squared), c_real);
-#ifdef __FMA__
-        z_imag = _mm256_fmadd_pd(two, _mm256_mul_pd(z_real, z_imag), c_imag);
-#else
-        z_imag = _mm256_add_pd(_mm256_mul_pd(two, _mm256_mul_pd(z_real, z_imag)), c_imag);
-#endif
-        z_real = temp_zreal;
-
-        //Increment the corresponding count only if we haven't converged yet
-        __m256i incrementor = (__m256i)_mm256_and_pd(compare, (__m256d)one_i);//If a number hasn't converged, we will increment it's count
-
-        //Actually perform the addition
-#ifdef __AVX2__
-        result = _mm256_add_epi64(result, incrementor);//Requires AVX2
-#else//We must add the top and bottom seperatly
-        __m128i lower_result = _mm256_castsi256_si128(result);
-        __m128i upper_result = _mm256_extractf128_si256(result, 1);
-        __m128i lower_incrementor = _mm256_castsi256_si128(incrementor);
-        __m128i upper_incrementor = _mm256_extractf128_si256(incrementor, 1);
-        __m128i lower_sum = _mm_add_epi64(lower_result, lower_incrementor);
-        __m128i upper_sum = _mm_add_epi64(upper_result, upper_incrementor);
-        result = _mm256_castsi128_si256(lower_sum);
-        result = _mm256_insertf128_si256(result, upper_sum, 1);
-#endif
+    for (; i < x_pixels; ++i)
+    {
+        const uint32_t pixel = colours[row[i]];
+        render_row[(i * 3)] = pixel & 0xFF;
+        render_row[(i * 3) + 1] = (pixel >> 8) & 0xFF;
+        render_row[(i * 3) + 2] = (pixel >> 16) & 0xFF;
     }
 
-    //Pack the four 64 bit values into the lower 64 bits (16 bits each)
-    //TODO can this be done faster
-    //TODO can this be done faster when using avx2?
-    //https://stackoverflow.com/questions/69408063/how-to-convert-int-64-to-int-32-with-avx-but-without-avx-512
-    __m256 result_f = _mm256_castsi256_ps(result);
-    __m128 lower_result_f = _mm256_castps256_ps128(result_f);
-    __m128 upper_result_f = _mm256_extractf128_ps(result_f, 1);
-    __m128 packed = _mm_shuffle_ps(lower_result_f, upper_result_f, _MM_SHUFFLE(2, 0, 2, 0));
-    __m128i shuffle_mask = _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 0, 0, 0, 0, 0, 0, 0, 0);
-    __m128i result_final = _mm_shuffle_epi8(_mm_castps_si128(packed), shuffle_mask);
-    return _mm256_castsi128_si256(result_final);
+    //Zero the padding out to the end of the row
+    memset(&render_row[x_pixels * 3], 0, row_len_bytes - (x_pixels * 3));
+}
+
+static inline void store_le32(uint8_t* destination, uint32_t value)
+{
+    //Compilers merge these into one store on little endian machines
+    destination[0] = value & 0xFF;
+    destination[1] = (value >> 8) & 0xFF;
+    destination[2] = (value >> 16) & 0xFF;
+    destination[3] = (value >> 24) & 0xFF;
 }
-#endif
 
-static void intensities_render_inverted_8(bmp_t* restrict render, const mb_intensities_t* restrict intensities)//TODO make this faster/multithreaded/vectorize
+static bool render_direct_rows(bmp_t* restrict render, const renderer_t* restrict renderer, mb_intensities_t* restrict band, uint64_t min_y_px, uint64_t max_y_px)
 {
+    if (min_y_px >= max_y_px)
+        return true;
+
+    //Each thread reuses one strip of scratch intensities for every strip it renders. A strip of a 4K wide image is about
+    //128 KiB of intensities, so it stays in cache until it is coloured
 #ifdef MBBMP_THREADING
-    thrd_t threads[processing_chunks];
-    render_thread_workload_t workloads[processing_chunks];
+    const uint16_t num_threads = pool_threads();
+#else
+    const uint16_t num_threads = 1;
+#endif
+    uint16_t** strips = (uint16_t**) calloc(num_threads, sizeof(uint16_t*));
+    bool success = strips;
+    for (uint16_t i = 0; success && (i < num_threads); ++i)
+    {
+        strips[i] = (uint16_t*) aligned_alloc(INTENSITY_ROW_ALIGNMENT, sizeof(uint16_t) * band->row_stride * RENDER_BAND_HEIGHT);
+        success = strips[i];
+    }
 
-    for (uint8_t i = 0; i < processing_chunks; ++i)
+    if (success)
     {
-        //Wait for our time to begin
-        while (current_threads >= max_threads)
-            thrd_yield();
-        ++current_threads;//It's okay if we're not atomic with this comparison after the above since we only increment it here
+        direct_workload_t workload = {.render = render, .renderer = renderer, .band = band, .min_y_px = min_y_px, .max_y_px = max_y_px, .strips = strips};
+        atomic_init(&workload.interior_px, 0);
+        const uint32_t num_strips = ((max_y_px - min_y_px) + RENDER_BAND_HEIGHT - 1) / RENDER_BAND_HEIGHT;
+
+#ifdef MBBMP_THREADING
+        pool_run(render_direct_strip, (void*)&workload, num_strips);
+#else
+        for (uint32_t i = 0; i < num_strips; ++i)
+            render_direct_strip(&workload, i);
+#endif
 
-        workloads[i].thread_num = i;
-        workloads[i].render = render;
-        workloads[i].intensities = intensities;
-        thrd_create(&threads[i], intensities_render_inverted_8_thread, (void*)&workloads[i]);
+        band->interior_px += atomic_load(&workload.interior_px);
     }
 
-    for (uint8_t i = 0; i < processing_chunks; ++i)
+    if (strips)
     {
-        thrd_join(threads[i], NULL);
+        for (uint16_t i = 0; i < num_threads; ++i)
+            free(strips[i]);
+        free(strips);
     }
+    return success;
+}
+
+static void render_direct_strip(void* workload_, uint32_t strip_num)
+{
+    direct_workload_t* workload = (direct_workload_t*) workload_;
+    const mb_intensities_t* band = workload->band;
+
+    //The last strip is clipped to the bottom of the rows being rendered
+    const uint64_t min_y_px = workload->min_y_px + ((uint64_t) strip_num * RENDER_BAND_HEIGHT);
+    const uint64_t max_y_px = ((workload->max_y_px - min_y_px) < RENDER_BAND_HEIGHT) ? workload->max_y_px : (min_y_px + RENDER_BAND_HEIGHT);
+
+#ifdef MBBMP_THREADING
+    uint16_t* strip = workload->strips[pool_worker_num()];
 #else
-    for (uint16_t i = 0; i < intensities->config.x_pixels; ++i)
-    {
-        for (uint16_t j = 0; j < intensities->config.y_pixels; ++j)
-        {
-            uint32_t value;
-            uint32_t intensity = intensities->intensities[i + (j * intensities->config.x_pixels)];
+    uint16_t* strip = workload->strips[0];
+#endif
 
-            if (intensity >= ITERATIONS)
-                value = 0;
-            else
-                value = 255 - ((intensity * 255) / ITERATIONS);
+    kernel_region_t region = band->state->generation.region;
+    region.intensities = strip;
+    region.first_row = min_y_px;
+    region.max_x_px = band->config.x_pixels;
+    region.min_y_px = min_y_px;
+    region.max_y_px = max_y_px;
+    atomic_fetch_add_explicit(&workload->interior_px, band->state->generation.kernel(&region), memory_order_relaxed);
 
-            bmp_px_set_8(render, i, j, value);
-        }
-    }
+    for (uint64_t j = min_y_px; j < max_y_px; ++j)
+        colour_row(workload->render, workload->renderer, j - band->first_row, kernel_region_row(&region, j), band->config.x_pixels);
+}
+
+static bool kernel_supported(size_t kernel_num)
+{
+    const char* name = kernels_table[kernel_num].name;
+
+#if MBBMP_X86
+    //__builtin_cpu_supports() also checks that the OS saves the wider registers
+    if (!strcmp(name, "avx512"))
+        return __builtin_cpu_supports("avx512f");
+    else if (!strcmp(name, "avx2"))
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    else if (!strcmp(name, "avx"))
+        return __builtin_cpu_supports("avx");
+    else if (!strcmp(name, "sse2"))
+        return __builtin_cpu_supports("sse2");
 #endif
+
+    return !strcmp(name, "scalar");
 }
 
-#ifdef MBBMP_THREADING
-static int intensities_render_inverted_8_thread(void* workload_)
+static size_t active_kernel_num(void)
 {
-    render_thread_workload_t* workload = (render_thread_workload_t*) workload_;
+    if (chosen_kernel != NUM_KERNELS)
+        return chosen_kernel;
 
-    const uint16_t thread_x_px = workload->intensities->config.x_pixels / processing_chunks;
-    for (uint16_t i = thread_x_px * workload->thread_num; i < thread_x_px * (workload->thread_num + 1); ++i)
+    //Use the best kernel we can, and remember it so we only have to check the CPU once
+    for (size_t i = 0; i < NUM_KERNELS; ++i)
     {
-        for (uint16_t j = 0; j < workload->intensities->config.y_pixels; ++j)
+        if (kernel_supported(i))
         {
-            uint32_t value;
-            uint32_t intensity = workload->intensities->intensities[i + (j * workload->intensities->config.x_pixels)];
-
-            if (intensity >= ITERATIONS)
-                value = 0;
-            else
-                value = 255 - ((intensity * 255) / ITERATIONS);
-
-            bmp_px_set_8(workload->render, i, j, value);
+            chosen_kernel = i;
+            return i;
         }
     }
 
-    --current_threads;
-    return 0;
+    assert(false);//The scalar kernel is always supported
+    return NUM_KERNELS - 1;
 }
-#endif
 
-#ifdef MBBMP_THREADING
-static int generate_intensities_threaded(void* workload_)
+static kernel_t active_kernel(void)
 {
-    intensity_thread_workload_t* workload = (intensity_thread_workload_t*) workload_;
+    size_t kernel_num = active_kernel_num();
+    return lane_refill ? kernels_table[kernel_num].refill_kernel : kernels_table[kernel_num].kernel;
+}
 
-    mb_intensities_t* intensities = workload->intensities;
-    mb_config_t* config = &intensities->config;
+static void init_generation(generation_t* generation, const mb_intensities_t* intensities, const perturb_reference_t* reference)
+{
+    const mb_config_t* config = &intensities->config;
+    kernel_region_t* region = &generation->region;
 
-    const uint16_t thread_x_px = config->x_pixels / processing_chunks;//TODO what about rounding/excess pixels?
+    region->intensities = (uint16_t*) intensities->intensities;
+    region->first_row = intensities->first_row;
+    region->row_stride = intensities->row_stride;
 
-    /* This line here causes lots of issues.
-     * When using low-precision numbers (floats), the subtraction done here causes a severe loss of precision that
-     * leads to rendering glitches. While this can be mitigated by adding x_step to config->min_x until we reach the
-     * desired spot, that is sort of a hack and is not efficient enough to be worth it.
+    /* The subtractions here cause lots of issues.
+     * When using low-precision numbers (floats), they cause a severe loss of precision that leads to rendering glitches.
      * We thus use doubles everywhere in mandelbrot_bmp_generator as they are a good balance of precision
-     * (comparing with floats/long doubles) and can more easily be vectorized
+     * (comparing with floats/long doubles) and can more easily be vectorized.
+     * The kernels calculate each coordinate from its pixel index rather than by repeatedly adding the step, so that
+     * error doesn't accumulate across a row/column (and so tiles line up exactly with each other)
     */
-    const double thread_x_range = (config->max_x - config->min_x) / processing_chunks;
+    region->min_x = config->min_x;
+    region->min_y = config->min_y;
+    region->min_x_low = 0;
+    region->min_y_low = 0;
+    region->x_step = (config->max_x - config->min_x) / config->x_pixels;
+    region->y_step = (config->max_y - config->min_y) / config->y_pixels;
 
-    const double x_step = (config->max_x - config->min_x) / config->x_pixels;
-    const double y_step = (config->max_y - config->min_y) / config->y_pixels;
+    region->max_iterations = config->max_iterations;
 
-    double x = config->min_x + (thread_x_range * workload->thread_num);
+    region->reference_real = NULL;
+    region->reference_imag = NULL;
+    region->reference_length = 0;
 
-#ifdef __AVX512F__
-    assert(false);//TODO implement
-#elif defined(__AVX__)
-    //TODO what if not an number of pixels divisible by 4?
-    for (uint16_t i = thread_x_px * workload->thread_num; i < thread_x_px * (workload->thread_num + 1); i += 4)
+    const size_t kernel_num = active_kernel_num();
+    switch (intensities->precision)
     {
-        //Perform mandelbrot iterations on four values at once!
-        __m256d real = _mm256_set_pd(x + (3 * x_step), x + (2 * x_step), x + x_step, x);
-
-        double y = config->min_y;
-        for (uint16_t j = 0; j < config->y_pixels; ++j)
+        case MB_PRECISION_FLOAT:
+            //There is no float lane refill kernel; narrow pieces when border tracing are better off with the double one
+            //than with most of a group of float vectors going to waste
+            generation->kernel = kernels_table[kernel_num].float_kernel;
+            generation->refill_kernel = kernels_table[kernel_num].refill_kernel;
+            break;
+        case MB_PRECISION_DOUBLE:
+            generation->kernel = active_kernel();
+            generation->refill_kernel = kernels_table[kernel_num].refill_kernel;
+            break;
+        case MB_PRECISION_DOUBLE_DOUBLE:
         {
-            //Perform mandelbrot iterations on four values at once!
-            __m256d imag = _mm256_set1_pd(y);
+            //Pixels are placed from the precise bounds (if there are any) split into pairs of doubles
+            perturb_dd_origin_t origin;
+            perturb_dd_origin(&origin, config);
+            region->min_x = origin.min_x;
+            region->min_x_low = origin.min_x_low;
+            region->min_y = origin.min_y;
+            region->min_y_low = origin.min_y_low;
+            region->x_step = origin.x_step;
+            region->y_step = origin.y_step;
+
+            generation->kernel = kernels_table[kernel_num].dd_kernel;
+            generation->refill_kernel = generation->kernel;
+            break;
+        }
+        case MB_PRECISION_PERTURB:
+            //Pixels are placed relative to the reference point instead
+            region->min_x = reference->min_x;
+            region->min_y = reference->min_y;
+            region->x_step = reference->x_step;
+            region->y_step = reference->y_step;
+
+            region->reference_real = reference->real;
+            region->reference_imag = reference->imag;
+            region->reference_length = reference->length;
+
+            generation->kernel = kernels_table[kernel_num].perturb_kernel;
+            generation->refill_kernel = generation->kernel;
+            break;
+    }
 
-            //The results are stored in the lower 64 bits (16 bits each) and so can be directly stored
-            __m128i result = _mm256_extractf128_si256(mandelbrot_iterations_avx_4(real, imag), 0);
-            _mm_storeu_si64(&intensities->intensities[i + (j * config->x_pixels)], result);
+    region->min_x_px = 0;
+    region->max_x_px = 0;
+    region->min_y_px = 0;
+    region->max_y_px = 0;
+}
 
-            y += y_step;
-        }
+static inline uint16_t* intensities_row(const mb_intensities_t* intensities, uint64_t j)
+{
+    return (uint16_t*) &intensities->intensities[(j - intensities->first_row) * intensities->row_stride];
+}
+
+static void mirrored_rows(const struct mb_generation_state* state, uint64_t first_row, uint64_t end_row, uint64_t* first_mirrored_row, uint64_t* end_mirrored_rows)
+{
+    //Rows j and mirror_sum - j are reflections of each other across the real axis, so the ones in [first_row, end_row)
+    //past the axis whose reflection is in there too can be copied from it (an empty range at end_row if there are none)
+    *first_mirrored_row = end_row;
+    *end_mirrored_rows = end_row;
 
-        x += x_step * 4;
+    if (!state->mirror || (state->mirror_sum < first_row))
+        return;
+
+    const uint64_t mirror_sum = state->mirror_sum;
+    const uint64_t first = (first_row > ((mirror_sum / 2) + 1)) ? first_row : ((mirror_sum / 2) + 1);
+    const uint64_t end = ((mirror_sum - first_row) < end_row) ? (mirror_sum - first_row + 1) : end_row;
+
+    if (first < end)
+    {
+        *first_mirrored_row = first;
+        *end_mirrored_rows = end;
     }
-#elif defined(__SSE2__)
-    //TODO what if not an even number of pixels?
-    for (uint16_t i = thread_x_px * workload->thread_num; i < thread_x_px * (workload->thread_num + 1); i += 2)
+}
+
+static bool find_mirror_sum(const mb_config_t* config, uint64_t* mirror_sum)
+{
+    //Row j is sampled at y = min_y + (j * y_step) (the top/left edge of the pixel, not its centre), so rows j and k are
+    //exact reflections when j + k = -2 * min_y / y_step; only worth it if that is a whole number with a pair in the image
+    if ((config->min_y >= 0) || (config->max_y <= 0))
+        return false;
+
+    const double y_step = (config->max_y - config->min_y) / config->y_pixels;
+    const double sum = (-2 * config->min_y) / y_step;
+    const double rounded_sum = nearbyint(sum);
+
+    if ((fabs(sum - rounded_sum) > MIRROR_TOLERANCE) || (rounded_sum < 1) || (rounded_sum > ((2.0 * config->y_pixels) - 3)))
+        return false;
+
+    *mirror_sum = (uint64_t) rounded_sum;
+    return true;
+}
+
+static void generate_rows(mb_intensities_t* intensities, const generation_t* generation, uint64_t min_y_px, uint64_t max_y_px)
+{
+    const mb_config_t* config = &intensities->config;
+
+    if (min_y_px >= max_y_px)
+        return;
+
+    if (border_tracing)
     {
-        //Perform mandelbrot iterations on two values at once!
-        __m128d real = _mm_set_pd(x + x_step, x);
+        generate_intensities_traced(intensities, generation, min_y_px, max_y_px);
+        return;
+    }
 
-        double y = config->min_y;
-        for (uint16_t j = 0; j < config->y_pixels; ++j)
-        {
-            //Perform mandelbrot iterations on two values at once!
-            __m128d imag = _mm_set_pd1(y);
+#ifdef MBBMP_THREADING
+    const uint64_t tiles_per_row = (config->x_pixels + TILE_WIDTH - 1) / TILE_WIDTH;
+    const uint64_t tiles_per_column = ((max_y_px - min_y_px) + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    intensity_thread_workload_t workload = {.intensities = intensities, .generation = generation, .min_y_px = min_y_px, .max_y_px = max_y_px};
+    atomic_init(&workload.interior_px, 0);
+    pool_run(generate_intensities_threaded, (void*)&workload, tiles_per_row * tiles_per_column);
+    intensities->interior_px += atomic_load(&workload.interior_px);
+#else
+    //Do all of the rows as one region
+    kernel_region_t region = generation->region;
+    region.max_x_px = config->x_pixels;
+    region.min_y_px = min_y_px;
+    region.max_y_px = max_y_px;
+    intensities->interior_px += generation->kernel(&region);
+#endif
+}
 
-            //The results are stored in the lower 32 bits (16 bits each) and so can be directly stored
-            __m128i result = mandelbrot_iterations_sse2_2(real, imag);
-            _mm_storeu_si32(&intensities->intensities[i + (j * config->x_pixels)], result);
+#ifdef MBBMP_THREADING
+static void generate_intensities_threaded(void* workload_, uint32_t tile_num)
+{
+    intensity_thread_workload_t* workload = (intensity_thread_workload_t*) workload_;
+    const mb_config_t* config = &workload->intensities->config;
 
-            y += y_step;
-        }
+    kernel_region_t region = workload->generation->region;
+
+    //Tiles are numbered row by row; the last tile in each direction is clipped to the edge of the rows being generated
+    const uint64_t tiles_per_row = (config->x_pixels + TILE_WIDTH - 1) / TILE_WIDTH;
+    region.min_x_px = (tile_num % tiles_per_row) * TILE_WIDTH;
+    region.min_y_px = workload->min_y_px + ((tile_num / tiles_per_row) * TILE_HEIGHT);
+    region.max_x_px = ((config->x_pixels - region.min_x_px) < TILE_WIDTH) ? config->x_pixels : (region.min_x_px + TILE_WIDTH);
+    region.max_y_px = ((workload->max_y_px - region.min_y_px) < TILE_HEIGHT) ? workload->max_y_px : (region.min_y_px + TILE_HEIGHT);
+
+    atomic_fetch_add_explicit(&workload->interior_px, workload->generation->kernel(&region), memory_order_relaxed);
+}
+#endif
+
+static void generate_intensities_traced(mb_intensities_t* intensities, const generation_t* generation, uint64_t min_y_px, uint64_t max_y_px)
+{
+    const mb_config_t* config = &intensities->config;
+
+    //Start from a grid of tiles so there is plenty to spread between the workers from the very first level
+    const uint64_t tiles_per_row = (config->x_pixels + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    const uint64_t tiles_per_column = ((max_y_px - min_y_px) + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+    uint32_t num_rects = tiles_per_row * tiles_per_column;
 
-        x += x_step * 2;
+    trace_rect_t* rects = (trace_rect_t*) malloc(sizeof(trace_rect_t) * num_rects);
+    for (uint32_t i = 0; i < num_rects; ++i)
+    {
+        rects[i].min_x_px = (i % tiles_per_row) * TRACE_TILE_SIZE;
+        rects[i].min_y_px = min_y_px + ((i / tiles_per_row) * TRACE_TILE_SIZE);
+        rects[i].max_x_px = ((config->x_pixels - rects[i].min_x_px) < TRACE_TILE_SIZE) ? config->x_pixels : (rects[i].min_x_px + TRACE_TILE_SIZE);
+        rects[i].max_y_px = ((max_y_px - rects[i].min_y_px) < TRACE_TILE_SIZE) ? max_y_px : (rects[i].min_y_px + TRACE_TILE_SIZE);
     }
+
+    trace_workload_t workload =
+    {
+        .intensities = intensities,
+        .generation = generation,
+        .borders_done = false
+    };
+    atomic_init(&workload.interior_px, 0);
+    atomic_init(&workload.filled_px, 0);
+
+    //Each level is one pass over the pool (jobs can't submit more jobs), until no rectangle needs subdividing
+    while (num_rects)
+    {
+        workload.rects = rects;
+        workload.next_rects = (trace_rect_t*) malloc(sizeof(trace_rect_t) * num_rects * 4);//Each splits into at most 4
+        atomic_init(&workload.num_next_rects, 0);
+
+#ifdef MBBMP_THREADING
+        pool_run(trace_rect, (void*)&workload, num_rects);
 #else
-    for (uint16_t i = thread_x_px * workload->thread_num; i < thread_x_px * (workload->thread_num + 1); ++i)
+        for (uint32_t i = 0; i < num_rects; ++i)
+            trace_rect(&workload, i);
+#endif
+
+        free(rects);
+        rects = workload.next_rects;
+        num_rects = atomic_load(&workload.num_next_rects);
+        workload.borders_done = true;
+    }
+    free(rects);
+
+    intensities->interior_px += atomic_load(&workload.interior_px);
+    intensities->filled_px += atomic_load(&workload.filled_px);
+}
+
+static void trace_rect(void* workload_, uint32_t rect_num)
+{
+    trace_workload_t* workload = (trace_workload_t*) workload_;
+    const trace_rect_t rect = workload->rects[rect_num];
+    const uint64_t width = rect.max_x_px - rect.min_x_px;
+    const uint64_t height = rect.max_y_px - rect.min_y_px;
+    uint64_t interior_px = 0;
+
+    if (!workload->borders_done)
+    {
+        //Top and bottom rows, then the left and right columns between them
+        interior_px += trace_compute(workload, rect.min_x_px, rect.max_x_px, rect.min_y_px, rect.min_y_px + 1);
+        if (height > 1)
+            interior_px += trace_compute(workload, rect.min_x_px, rect.max_x_px, rect.max_y_px - 1, rect.max_y_px);
+        interior_px += trace_compute(workload, rect.min_x_px, rect.min_x_px + 1, rect.min_y_px + 1, rect.max_y_px - 1);
+        if (width > 1)
+            interior_px += trace_compute(workload, rect.max_x_px - 1, rect.max_x_px, rect.min_y_px + 1, rect.max_y_px - 1);
+    }
+
+    if ((width > 2) && (height > 2))//Otherwise there is nothing inside the border
     {
-        double y = config->min_y;
+        const uint16_t value = intensities_row(workload->intensities, rect.min_y_px)[rect.min_x_px];
+        if ((value == workload->intensities->config.max_iterations) && trace_border_uniform(workload->intensities, &rect))
+        {
+            //The set has no holes, so a rectangle whose border is in the set is entirely in it. Only the centres of the
+            //border pixels are checked though, so an escaping channel thinner than a pixel can still be filled over.
+            //Borders of one escape count aren't filled: bands of equal counts are rings around minibrots and filaments,
+            //so the inside of such a border can hold other counts
+
+            for (uint64_t j = rect.min_y_px + 1; j < (rect.max_y_px - 1); ++j)
+            {
+                uint16_t* row = intensities_row(workload->intensities, j);
 
-        for (uint16_t j = 0; j < config->y_pixels; ++j)
+                for (uint64_t i = rect.min_x_px + 1; i < (rect.max_x_px - 1); ++i)
+                    row[i] = value;
+            }
+
+            atomic_fetch_add_explicit(&workload->filled_px, (width - 2) * (height - 2), memory_order_relaxed);
+        }
+        else if ((width <= TRACE_MIN_SIZE) || (height <= TRACE_MIN_SIZE))//Not worth subdividing any further
+            interior_px += trace_compute(workload, rect.min_x_px + 1, rect.max_x_px - 1, rect.min_y_px + 1, rect.max_y_px - 1);
+        else
         {
-            intensities->intensities[i + (j * config->x_pixels)] = mandelbrot_iterations_basic(CMPLXF(x, y));
-            y += y_step;
+            //Split into quarters along a row and a column through the middle; computing those now completes the
+            //borders of all four quarters
+            const uint64_t mid_x = rect.min_x_px + (width / 2);
+            const uint64_t mid_y = rect.min_y_px + (height / 2);
+            interior_px += trace_compute(workload, rect.min_x_px + 1, rect.max_x_px - 1, mid_y, mid_y + 1);
+            interior_px += trace_compute(workload, mid_x, mid_x + 1, rect.min_y_px + 1, mid_y);
+            interior_px += trace_compute(workload, mid_x, mid_x + 1, mid_y + 1, rect.max_y_px - 1);
+
+            trace_rect_t* children = &workload->next_rects[atomic_fetch_add(&workload->num_next_rects, 4)];
+            children[0] = (trace_rect_t){.min_x_px = rect.min_x_px, .max_x_px = mid_x + 1, .min_y_px = rect.min_y_px, .max_y_px = mid_y + 1};
+            children[1] = (trace_rect_t){.min_x_px = mid_x, .max_x_px = rect.max_x_px, .min_y_px = rect.min_y_px, .max_y_px = mid_y + 1};
+            children[2] = (trace_rect_t){.min_x_px = rect.min_x_px, .max_x_px = mid_x + 1, .min_y_px = mid_y, .max_y_px = rect.max_y_px};
+            children[3] = (trace_rect_t){.min_x_px = mid_x, .max_x_px = rect.max_x_px, .min_y_px = mid_y, .max_y_px = rect.max_y_px};
         }
+    }
+
+    atomic_fetch_add_explicit(&workload->interior_px, interior_px, memory_order_relaxed);
+}
+
+static uint64_t trace_compute(trace_workload_t* workload, uint64_t min_x_px, uint64_t max_x_px, uint64_t min_y_px, uint64_t max_y_px)
+{
+    if ((min_x_px >= max_x_px) || (min_y_px >= max_y_px))
+        return 0;
+
+    kernel_region_t region = workload->generation->region;
+    region.min_x_px = min_x_px;
+    region.max_x_px = max_x_px;
+    region.min_y_px = min_y_px;
+    region.max_y_px = max_y_px;
+
+    //Narrow pieces waste most of the lanes in the normal kernel's groups of vectors, so they go to the lane refill kernel
+    //instead. Its per-pixel overhead only pays off for columns or when there are lots of iterations to spread it over
+    const uint64_t width = max_x_px - min_x_px;
+    const bool refill = (width == 1) || ((width < TRACE_VECTOR_MIN_WIDTH) && (region.max_iterations >= TRACE_REFILL_MIN_ITERATIONS));
+    return (refill ? workload->generation->refill_kernel : workload->generation->kernel)(&region);
+}
+
+static bool trace_border_uniform(const mb_intensities_t* intensities, const trace_rect_t* rect)
+{
+    const uint16_t* top = intensities_row(intensities, rect->min_y_px);
+    const uint16_t* bottom = intensities_row(intensities, rect->max_y_px - 1);
+    const uint16_t value = top[rect->min_x_px];
 
-        x += x_step;
+    for (uint64_t i = rect->min_x_px; i < rect->max_x_px; ++i)
+    {
+        if ((top[i] != value) || (bottom[i] != value))
+            return false;
     }
-#endif
 
-    --current_threads;
-    return 0;
+    for (uint64_t j = rect->min_y_px + 1; j < (rect->max_y_px - 1); ++j)
+    {
+        const uint16_t* row = intensities_row(intensities, j);
+
+        if ((row[rect->min_x_px] != value) || (row[rect->max_x_px - 1] != value))
+            return false;
+    }
+
+    return true;
 }
-#endif
@@ -0,0 +1,287 @@
+/* Colour maps
+ * By: John Jekel
+*/
+
+/* Constants And Defines */
+
+//More colours than there can be escape counts would never be used
+#define MAX_COLOURS 65536
+
+/* Includes */
+
+#include "palette.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Static Function Declarations */
+
+static void palette_create(palette_t* palette, palette_mapping_t mapping, uint32_t num_colours);
+static palette_colour_t band_colour(uint8_t i);
+static uint32_t colour_num(const palette_t* palette, uint32_t intensity, uint16_t max_iterations);
+static bool parse_colour(const char* str, palette_colour_t* colour);
+static bool colours_equal(palette_colour_t a, palette_colour_t b);
+
+/* Function Implementations */
+
+bool palette_builtin(palette_t* palette, const char* name)
+{
+    if (!strcmp(name, "grey"))
+    {
+        //Darker the closer to the set
+        palette_create(palette, PALETTE_STRETCH, 256);
+        for (uint32_t i = 0; i < 256; ++i)
+            palette->colours[i] = (palette_colour_t){.r = i, .g = i, .b = i, .a = 0};
+    }
+    else if (!strcmp(name, "bands"))
+    {
+        //Bands of red, yellow, green, cyan, blue and magenta, getting darker towards the set
+        palette_create(palette, PALETTE_STRETCH, 256);
+        for (uint32_t i = 0; i < 256; ++i)
+            palette->colours[i] = band_colour(i);
+    }
+    else if (!strcmp(name, "rgb"))
+    {
+        //Escape counts alternate between shades of red, green and blue, each ramping up over 128 counts
+        palette_create(palette, PALETTE_CYCLE, 384);
+        for (uint32_t i = 0; i < 384; ++i)
+        {
+            const uint8_t shade = (i % 128) << 1;
+            palette->colours[i] = (palette_colour_t){.r = ((i % 3) == 0) ? shade : 0, .g = ((i % 3) == 1) ? shade : 0, .b = ((i % 3) == 2) ? shade : 0, .a = 0};
+        }
+    }
+    else
+        return false;
+
+    return true;
+}
+
+bool palette_load(palette_t* palette, const char* file_name)
+{
+    FILE* file = fopen(file_name, "r");
+    if (!file)
+        return false;
+
+    palette->mapping = PALETTE_STRETCH;
+    palette->inside = (palette_colour_t){.r = 0, .g = 0, .b = 0, .a = 0};
+    palette->num_colours = 0;
+    palette->colours = NULL;
+    uint32_t capacity = 0;
+    bool success = true;
+
+    char line[256];
+    while (success && fgets(line, sizeof(line), file))
+    {
+        //Skip blank lines and comments
+        char word[16];
+        if ((sscanf(line, " %15s", word) != 1) || (word[0] == '#'))
+            continue;
+
+        palette_colour_t colour;
+        if (!strcmp(word, "stretch"))
+            palette->mapping = PALETTE_STRETCH;
+        else if (!strcmp(word, "cycle"))
+            palette->mapping = PALETTE_CYCLE;
+        else if (!strcmp(word, "inside"))
+            success = parse_colour(strstr(line, "inside") + 6, &palette->inside);
+        else if (parse_colour(line, &colour) && (palette->num_colours < MAX_COLOURS))
+        {
+            if (palette->num_colours == capacity)
+            {
+                //Keep the old colours if this fails so they are still freed below
+                const uint32_t new_capacity = capacity ? (capacity * 2) : 256;
+                palette_colour_t* colours = (palette_colour_t*) realloc(palette->colours, sizeof(palette_colour_t) * new_capacity);
+                if (colours)
+                {
+                    palette->colours = colours;
+                    capacity = new_capacity;
+                }
+                else
+                    success = false;
+            }
+
+            if (success)
+            {
+                palette->colours[palette->num_colours] = colour;
+                ++palette->num_colours;
+            }
+        }
+        else
+            success = false;
+    }
+
+    fclose(file);
+
+    if (!success || !palette->num_colours)
+    {
+        free(palette->colours);
+        return false;
+    }
+
+    return true;
+}
+
+void palette_destroy(palette_t* palette)
+{
+    free(palette->colours);
+}
+
+void palette_compile_24(const palette_t* palette, uint16_t max_iterations, uint32_t* colours)
+{
+    for (uint32_t intensity = 0; intensity <= max_iterations; ++intensity)
+    {
+        const palette_colour_t colour = (intensity == max_iterations) ? palette->inside : palette->colours[colour_num(palette, intensity, max_iterations)];
+        colours[intensity] = colour.b | (colour.g << 8) | ((uint32_t) colour.r << 16);//Bitmaps store blue first
+    }
+}
+
+uint_fast16_t palette_compile_indexed(const palette_t* palette, uint16_t max_iterations, uint8_t* indices, palette_colour_t* bmp_palette, uint_fast16_t max_colours)
+{
+    //Palettes with more colours than fit are sampled evenly
+    uint_fast16_t num_bmp_colours = (palette->num_colours < max_colours) ? palette->num_colours : max_colours;
+    for (uint_fast16_t i = 0; i < num_bmp_colours; ++i)
+        bmp_palette[i] = palette->colours[((uint64_t) i * palette->num_colours) / num_bmp_colours];
+
+    //Points in the set get their own entry unless another one is already the same colour
+    bool inside_appended = false;
+    uint_fast16_t inside_index = num_bmp_colours;
+    for (uint_fast16_t i = 0; i < num_bmp_colours; ++i)
+    {
+        if (colours_equal(bmp_palette[i], palette->inside))
+        {
+            inside_index = i;
+            break;
+        }
+    }
+
+    if (inside_index == num_bmp_colours)
+    {
+        if (num_bmp_colours == max_colours)//Make room
+        {
+            num_bmp_colours = max_colours - 1;
+            for (uint_fast16_t i = 0; i < num_bmp_colours; ++i)
+                bmp_palette[i] = palette->colours[((uint64_t) i * palette->num_colours) / num_bmp_colours];
+        }
+
+        inside_index = num_bmp_colours;
+        bmp_palette[num_bmp_colours] = palette->inside;
+        ++num_bmp_colours;
+        inside_appended = true;
+    }
+
+    //Escape counts only map to the sampled colours, not to an appended inside colour (but a sampled colour that happens
+    //to match the inside one is still theirs)
+    const uint_fast16_t num_sampled = inside_appended ? (num_bmp_colours - 1) : num_bmp_colours;
+    for (uint32_t intensity = 0; intensity < max_iterations; ++intensity)
+        indices[intensity] = ((uint64_t) colour_num(palette, intensity, max_iterations) * num_sampled) / palette->num_colours;
+    indices[max_iterations] = inside_index;
+
+    return num_bmp_colours;
+}
+
+/* Static Function Implementations */
+
+static void palette_create(palette_t* palette, palette_mapping_t mapping, uint32_t num_colours)
+{
+    palette->mapping = mapping;
+    palette->inside = (palette_colour_t){.r = 0, .g = 0, .b = 0, .a = 0};
+    palette->num_colours = num_colours;
+    palette->colours = (palette_colour_t*) malloc(sizeof(palette_colour_t) * num_colours);
+}
+
+static palette_colour_t band_colour(uint8_t i)
+{
+    palette_colour_t colour = {.r = 0, .g = 0, .b = 0, .a = 0};
+
+    const uint8_t max_iterations = 255;
+    const uint8_t band_range = max_iterations / 11;
+
+    if (!i)
+        return colour;
+    else if (i < band_range)
+    {
+        colour.r = i;
+    }
+    else if (i < (2 * band_range))
+    {
+        colour.r = i;
+        colour.g = i / 2;
+    }
+    else if (i < (3 * band_range))
+    {
+        colour.r = i;
+        colour.g = i;
+    }
+    else if (i < (4 * band_range))
+    {
+        colour.r = i / 2;
+        colour.g = i;
+    }
+    else if (i < (5 * band_range))
+    {
+        colour.g = i;
+    }
+    else if (i < (6 * band_range))
+    {
+        colour.g = i;
+        colour.b = i / 2;
+    }
+    else if (i < (7 * band_range))
+    {
+        colour.g = i;
+        colour.b = i;
+    }
+    else if (i < (8 * band_range))
+    {
+        colour.g = i / 2;
+        colour.b = i;
+    }
+    else if (i < (9 * band_range))
+    {
+        colour.b = i;
+    }
+    else if (i < (10 * band_range))
+    {
+        colour.r = i / 2;
+        colour.b = i;
+    }
+    else
+    {
+        colour.r = i;
+        colour.b = i;
+    }
+
+    return colour;
+}
+
+static uint32_t colour_num(const palette_t* palette, uint32_t intensity, uint16_t max_iterations)
+{
+    const uint32_t num_colours = palette->num_colours;
+
+    if (palette->mapping == PALETTE_CYCLE)
+        return intensity % num_colours;
+
+    //Counts just short of the limit get the first colour and a count of 0 the last
+    return (num_colours - 1) - (uint32_t)(((uint64_t) intensity * (num_colours - 1)) / max_iterations);
+}
+
+static bool parse_colour(const char* str, palette_colour_t* colour)
+{
+    unsigned int r, g, b;
+    char extra;
+
+    //Exactly 3 numbers from 0 to 255, with nothing after them
+    if ((sscanf(str, " %u %u %u %c", &r, &g, &b, &extra) != 3) || (r > 255) || (g > 255) || (b > 255))
+        return false;
+
+    *colour = (palette_colour_t){.r = r, .g = g, .b = b, .a = 0};
+    return true;
+}
+
+static bool colours_equal(palette_colour_t a, palette_colour_t b)
+{
+    return (a.r == b.r) && (a.g == b.g) && (a.b == b.b);
+}
@@ -0,0 +1,398 @@
+/* Deep zoom (perturbation) support
+ * By: John Jekel
+ *
+ * Once the step between pixels gets close to the precision of a double, the pixels can't even be placed accurately, let
+ * alone iterated. Moderately deep zooms are iterated by the double-double kernels, which just need the bounds split
+ * into pairs of doubles. Past that, the orbit of one reference point is computed with fixed point arithmetic
+ * (mb_precise_t), and every pixel is iterated by the perturbation kernels as a (double) delta from that orbit
+*/
+
+/* Constants And Defines */
+
+//Floats are used while the step between pixels is at least this fraction of the largest coordinate (leaving about 10
+//of a float's 24 bits to tell neighbouring pixels apart, with plenty to spare for error that builds up while iterating),
+//as long as the limit is below PERIODICITY_MIN_ITERATIONS
+#define FLOAT_MIN_RELATIVE_STEP 1e-4
+
+//Double-double is used once the step between pixels is less than this fraction of the largest coordinate (leaving fewer
+//than about 16 bits of a double to tell neighbouring pixels apart), and perturbation once it is less than this one. That
+//leaves double-double a lot more headroom, since long orbits amplify its rounding error far more than perturbation's
+#define DD_MAX_RELATIVE_STEP 1e-11
+#define PERTURB_MAX_RELATIVE_STEP 1e-22
+
+#define PRECISE_FRACTION_LIMBS (MB_PRECISE_LIMBS - MB_PRECISE_INTEGER_LIMBS)
+
+//Decimal digits kept when parsing; 224 bits after the point is only about 67 of them, so the rest can't matter
+#define PARSE_MAX_DIGITS 128
+
+/* Includes */
+
+#include "perturb.h"
+
+#include "kernels.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Static Function Declarations */
+
+static void get_precise_bounds(const mb_config_t* config, mb_precise_t* min_x, mb_precise_t* max_x, mb_precise_t* min_y, mb_precise_t* max_y);
+
+static bool precise_negative(const mb_precise_t* a);
+static void precise_negate(mb_precise_t* a);
+static void precise_add(const mb_precise_t* a, const mb_precise_t* b, mb_precise_t* result);
+static void precise_sub(const mb_precise_t* a, const mb_precise_t* b, mb_precise_t* result);
+static void precise_mul(const mb_precise_t* a, const mb_precise_t* b, mb_precise_t* result);
+static void precise_halve(mb_precise_t* a);
+static void precise_div_small(mb_precise_t* a, uint32_t divisor);//Only for non-negative numbers
+static void precise_from_double(double value, mb_precise_t* result);
+static double precise_to_double(const mb_precise_t* a);
+static void precise_split(const mb_precise_t* a, double* high, double* low);
+
+/* Function Implementations */
+
+bool mb_parse_precise(const char* string, mb_precise_t* result)
+{
+    const char* c = string;
+    bool negative = false;
+    if ((*c == '-') || (*c == '+'))
+        negative = *c++ == '-';
+
+    //Collect the significant digits and work out where the point goes (after point digits, which may be past either end
+    //of them)
+    uint8_t digits[PARSE_MAX_DIGITS];
+    long num_digits = 0;
+    long point = 0;
+    bool seen_point = false;
+    bool any_digits = false;
+    for (; *c; ++c)
+    {
+        if ((*c >= '0') && (*c <= '9'))
+        {
+            any_digits = true;
+
+            if (!num_digits && (*c == '0'))
+            {
+                if (seen_point)
+                    --point;//Leading zeros after the point move the first digit further from it
+            }
+            else if (num_digits < PARSE_MAX_DIGITS)
+                digits[num_digits++] = *c - '0';
+            else if (!seen_point)
+                return false;//Far too many digits before the point
+        }
+        else if ((*c == '.') && !seen_point)
+        {
+            seen_point = true;
+            point = num_digits;
+        }
+        else
+            break;
+    }
+
+    if (!any_digits)
+        return false;
+    if (!seen_point)
+        point = num_digits;
+
+    if ((*c == 'e') || (*c == 'E'))
+    {
+        char* end;
+        long exponent = strtol(c + 1, &end, 10);
+        if (end == (c + 1))
+            return false;
+
+        if (exponent < -(2 * PARSE_MAX_DIGITS))
+            exponent = -(2 * PARSE_MAX_DIGITS);//Anything smaller is 0 either way
+        else if (exponent > (2 * PARSE_MAX_DIGITS))
+            return false;
+
+        point += exponent;
+        c = end;
+    }
+
+    if (*c)
+        return false;
+
+    //Integer part: most significant digit first
+    uint64_t integer = 0;
+    for (long i = 0; i < point; ++i)
+    {
+        integer = (integer * 10) + ((i < num_digits) ? digits[i] : 0);
+        if (integer > INT32_MAX)
+            return false;
+    }
+
+    //Fraction part: least significant digit first, putting each digit before the point and dividing by 10
+    memset(result, 0, sizeof(mb_precise_t));
+    for (long i = num_digits - 1; i >= ((point > 0) ? point : 0); --i)
+    {
+        result->limbs[PRECISE_FRACTION_LIMBS] = digits[i];
+        precise_div_small(result, 10);
+    }
+    for (long i = point; i < 0; ++i)
+        precise_div_small(result, 10);//Zeros between the point and the first digit
+
+    result->limbs[PRECISE_FRACTION_LIMBS] = (uint32_t) integer;
+    if (negative)
+        precise_negate(result);
+    return true;
+}
+
+mb_precision_t perturb_precision_needed(const mb_config_t* config)
+{
+    double width, height;
+    if (config->precise)
+    {
+        mb_precise_t difference;
+        precise_sub(&config->precise_max_x, &config->precise_min_x, &difference);
+        width = precise_to_double(&difference);
+        precise_sub(&config->precise_max_y, &config->precise_min_y, &difference);
+        height = precise_to_double(&difference);
+    }
+    else
+    {
+        width = config->max_x - config->min_x;
+        height = config->max_y - config->min_y;
+    }
+
+    const double magnitude = fmax(fmax(fabs(config->min_x), fabs(config->max_x)), fmax(fabs(config->min_y), fabs(config->max_y)));
+    const double smallest_step = fmin(fabs(width) / config->x_pixels, fabs(height) / config->y_pixels);//Bounds may be either way around
+    if (smallest_step < (magnitude * PERTURB_MAX_RELATIVE_STEP))
+        return MB_PRECISION_PERTURB;
+    else if (smallest_step < (magnitude * DD_MAX_RELATIVE_STEP))
+        return MB_PRECISION_DOUBLE_DOUBLE;
+    else if ((smallest_step < (magnitude * FLOAT_MIN_RELATIVE_STEP)) || (config->max_iterations >= PERIODICITY_MIN_ITERATIONS))
+        return MB_PRECISION_DOUBLE;//Without periodicity checking, floats would be slower than doubles on interior points
+    else
+        return MB_PRECISION_FLOAT;
+}
+
+void perturb_dd_origin(perturb_dd_origin_t* origin, const mb_config_t* config)
+{
+    mb_precise_t min_x, max_x, min_y, max_y;
+    get_precise_bounds(config, &min_x, &max_x, &min_y, &max_y);
+
+    mb_precise_t difference;
+    precise_sub(&max_x, &min_x, &difference);
+    origin->x_step = precise_to_double(&difference) / config->x_pixels;
+    precise_sub(&max_y, &min_y, &difference);
+    origin->y_step = precise_to_double(&difference) / config->y_pixels;
+
+    precise_split(&min_x, &origin->min_x, &origin->min_x_low);
+    precise_split(&min_y, &origin->min_y, &origin->min_y_low);
+}
+
+void perturb_reference_create(perturb_reference_t* reference, const mb_config_t* config)
+{
+    mb_precise_t min_x, max_x, min_y, max_y;
+    get_precise_bounds(config, &min_x, &max_x, &min_y, &max_y);
+
+    //The reference point is the centre of the image; pixels are placed relative to it
+    mb_precise_t centre_x, centre_y, difference;
+    precise_add(&min_x, &max_x, &centre_x);
+    precise_halve(&centre_x);
+    precise_add(&min_y, &max_y, &centre_y);
+    precise_halve(&centre_y);
+
+    precise_sub(&max_x, &min_x, &difference);
+    reference->x_step = precise_to_double(&difference) / config->x_pixels;
+    precise_sub(&max_y, &min_y, &difference);
+    reference->y_step = precise_to_double(&difference) / config->y_pixels;
+
+    precise_sub(&min_x, &centre_x, &difference);
+    reference->min_x = precise_to_double(&difference);
+    precise_sub(&min_y, &centre_y, &difference);
+    reference->min_y = precise_to_double(&difference);
+
+    //Iterate the reference point at full precision, keeping each point of its orbit as doubles for the kernels (they only
+    //need the orbit to double precision, since the small deltas from it are what carry the fine detail)
+    reference->real = (double*) malloc(sizeof(double) * ((size_t) config->max_iterations + 1));
+    reference->imag = (double*) malloc(sizeof(double) * ((size_t) config->max_iterations + 1));
+
+    mb_precise_t z_real, z_imag;
+    memset(&z_real, 0, sizeof(mb_precise_t));
+    memset(&z_imag, 0, sizeof(mb_precise_t));
+
+    uint32_t length = 0;
+    while (true)
+    {
+        const double real = precise_to_double(&z_real);
+        const double imag = precise_to_double(&z_imag);
+        reference->real[length] = real;
+        reference->imag[length] = imag;
+        ++length;
+
+        //The escaped point is kept too; lanes rebase when they reach the end of the orbit, so it is never stepped past
+        if ((length > config->max_iterations) || (((real * real) + (imag * imag)) >= 4))
+            break;
+
+        //z_(n+1) = z_n^2 + c
+        mb_precise_t real_squared, imag_squared, product;
+        precise_mul(&z_real, &z_real, &real_squared);
+        precise_mul(&z_imag, &z_imag, &imag_squared);
+        precise_mul(&z_real, &z_imag, &product);
+
+        precise_add(&product, &product, &z_imag);
+        precise_add(&z_imag, &centre_y, &z_imag);
+        precise_sub(&real_squared, &imag_squared, &z_real);
+        precise_add(&z_real, &centre_x, &z_real);
+    }
+
+    reference->length = length;
+}
+
+void perturb_reference_destroy(perturb_reference_t* reference)
+{
+    free(reference->real);
+    free(reference->imag);
+}
+
+/* Static Function Implementations */
+
+static void get_precise_bounds(const mb_config_t* config, mb_precise_t* min_x, mb_precise_t* max_x, mb_precise_t* min_y, mb_precise_t* max_y)
+{
+    if (config->precise)
+    {
+        *min_x = config->precise_min_x;
+        *max_x = config->precise_max_x;
+        *min_y = config->precise_min_y;
+        *max_y = config->precise_max_y;
+    }
+    else
+    {
+        precise_from_double(config->min_x, min_x);
+        precise_from_double(config->max_x, max_x);
+        precise_from_double(config->min_y, min_y);
+        precise_from_double(config->max_y, max_y);
+    }
+}
+
+static bool precise_negative(const mb_precise_t* a)
+{
+    return a->limbs[MB_PRECISE_LIMBS - 1] >> 31;
+}
+
+static void precise_negate(mb_precise_t* a)
+{
+    //Invert and add one
+    uint64_t carry = 1;
+    for (uint_fast8_t i = 0; i < MB_PRECISE_LIMBS; ++i)
+    {
+        carry += (uint32_t) ~a->limbs[i];
+        a->limbs[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+}
+
+static void precise_add(const mb_precise_t* a, const mb_precise_t* b, mb_precise_t* result)
+{
+    uint64_t carry = 0;
+    for (uint_fast8_t i = 0; i < MB_PRECISE_LIMBS; ++i)
+    {
+        carry += (uint64_t) a->limbs[i] + b->limbs[i];
+        result->limbs[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+}
+
+static void precise_sub(const mb_precise_t* a, const mb_precise_t* b, mb_precise_t* result)
+{
+    mb_precise_t negated = *b;
+    precise_negate(&negated);
+    precise_add(a, &negated, result);
+}
+
+static void precise_mul(const mb_precise_t* a, const mb_precise_t* b, mb_precise_t* result)
+{
+    //Multiply the magnitudes, then fix up the sign
+    const bool negative = precise_negative(a) != precise_negative(b);
+    mb_precise_t x = *a, y = *b;
+    if (precise_negative(&x))
+        precise_negate(&x);
+    if (precise_negative(&y))
+        precise_negate(&y);
+
+    uint32_t product[2 * MB_PRECISE_LIMBS] = {0};
+    for (uint_fast8_t i = 0; i < MB_PRECISE_LIMBS; ++i)
+    {
+        uint64_t carry = 0;
+        for (uint_fast8_t j = 0; j < MB_PRECISE_LIMBS; ++j)
+        {
+            carry += ((uint64_t) x.limbs[i] * y.limbs[j]) + product[i + j];
+            product[i + j] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        product[i + MB_PRECISE_LIMBS] = (uint32_t) carry;
+    }
+
+    //The product has twice as many limbs after the point; drop the extra ones (truncating) along with the extra ones
+    //before it (which are only non-zero on overflow)
+    memcpy(result->limbs, &product[PRECISE_FRACTION_LIMBS], sizeof(result->limbs));
+    if (negative)
+        precise_negate(result);
+}
+
+static void precise_halve(mb_precise_t* a)
+{
+    //Arithmetic shift right by one
+    for (uint_fast8_t i = 0; i < (MB_PRECISE_LIMBS - 1); ++i)
+        a->limbs[i] = (a->limbs[i] >> 1) | (a->limbs[i + 1] << 31);
+    a->limbs[MB_PRECISE_LIMBS - 1] = (uint32_t)((int32_t) a->limbs[MB_PRECISE_LIMBS - 1] >> 1);
+}
+
+static void precise_div_small(mb_precise_t* a, uint32_t divisor)
+{
+    //Long division from the most significant limb down
+    uint64_t remainder = 0;
+    for (int_fast8_t i = MB_PRECISE_LIMBS - 1; i >= 0; --i)
+    {
+        const uint64_t dividend = (remainder << 32) | a->limbs[i];
+        a->limbs[i] = (uint32_t)(dividend / divisor);
+        remainder = dividend % divisor;
+    }
+}
+
+static void precise_from_double(double value, mb_precise_t* result)
+{
+    //Peel off 32 bits at a time from the most significant limb down (each subtraction is exact)
+    double magnitude = fabs(value);
+    for (int_fast8_t i = MB_PRECISE_LIMBS - 1; i >= 0; --i)
+    {
+        const int exponent = 32 * (i - PRECISE_FRACTION_LIMBS);
+        const double limb = floor(ldexp(magnitude, -exponent));
+        result->limbs[i] = (uint32_t) limb;
+        magnitude -= ldexp(limb, exponent);
+    }
+
+    if (value < 0)
+        precise_negate(result);
+}
+
+static double precise_to_double(const mb_precise_t* a)
+{
+    mb_precise_t magnitude = *a;
+    if (precise_negative(&magnitude))
+        precise_negate(&magnitude);
+
+    //Most significant limb first, so the less significant ones only ever round the result
+    double result = 0;
+    for (int_fast8_t i = MB_PRECISE_LIMBS - 1; i >= 0; --i)
+        result += ldexp(magnitude.limbs[i], 32 * (i - PRECISE_FRACTION_LIMBS));
+
+    return precise_negative(a) ? -result : result;
+}
+
+static void precise_split(const mb_precise_t* a, double* high, double* low)
+{
+    //The low part is whatever rounding to the high part left behind
+    *high = precise_to_double(a);
+
+    mb_precise_t rounded, remainder;
+    precise_from_double(*high, &rounded);
+    precise_sub(a, &rounded, &remainder);
+    *low = precise_to_double(&remainder);
+}
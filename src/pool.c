@@ -0,0 +1,276 @@
+/* Persistent worker thread pool
+ * By: John Jekel
+*/
+
+/* Includes */
+
+#include "pool.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef __STDC_NO_THREADS__
+#error "C11 threading support required for compiling pool.c"
+#endif
+
+#include <threads.h>
+
+/* Types */
+
+//Each worker owns a deque of job numbers. Since jobs are handed out as a contiguous range, the deque is just
+//[front, back): the owner pops from the front (keeping neighbouring tiles together), thieves take from the back
+typedef struct
+{
+    mtx_t lock;
+    uint32_t front, back;
+} job_deque_t;
+
+/* Variables */
+
+static thrd_t* workers = NULL;
+static job_deque_t* deques = NULL;
+static uint16_t num_workers = 0;
+static thread_local uint16_t this_worker_num = 0;//0 on any thread that isn't a worker (ex. when there is no pool yet)
+
+static mtx_t run_lock;//Only one pool_run() at a time (ex. interactive generates intensities in the background)
+static mtx_t lock;//Protects everything below
+static cnd_t work_available;
+static cnd_t work_done;
+
+static pool_job_t current_job;
+static void* current_data;
+static uint64_t run_generation = 0;//Incremented for each pool_run() so workers know there is something new to do
+static uint64_t creation_generation = 0;//run_generation when the current workers were created (they may start up late)
+static uint16_t workers_busy = 0;
+static bool shutting_down = false;
+
+/* Static Function Declarations */
+
+static void pool_init_once(void);
+static int worker_thread(void* worker_num_);
+static bool pop_own_job(uint16_t worker_num, uint32_t* job_num);
+static bool steal_jobs(uint16_t worker_num);
+
+/* Function Implementations */
+
+void pool_set_threads(uint16_t threads)
+{
+    assert(threads > 0);
+
+    static once_flag init_flag = ONCE_FLAG_INIT;
+    call_once(&init_flag, pool_init_once);
+
+    if (threads == num_workers)
+        return;//Keep the workers we already have
+
+    mtx_lock(&run_lock);//Don't pull workers out from under a running job
+    pool_destroy();
+
+    workers = (thrd_t*) malloc(sizeof(thrd_t) * threads);
+    deques = (job_deque_t*) malloc(sizeof(job_deque_t) * threads);
+    num_workers = threads;
+    creation_generation = run_generation;
+
+    for (uint16_t i = 0; i < threads; ++i)
+    {
+        mtx_init(&deques[i].lock, mtx_plain);
+        deques[i].front = 0;
+        deques[i].back = 0;
+    }
+
+    for (uint16_t i = 0; i < threads; ++i)
+        thrd_create(&workers[i], worker_thread, (void*)(uintptr_t)i);
+    mtx_unlock(&run_lock);
+}
+
+void pool_run(pool_job_t job, void* data, uint32_t num_jobs)
+{
+    if (!num_workers)//No pool yet, so just do the work on this thread
+    {
+        for (uint32_t i = 0; i < num_jobs; ++i)
+            job(data, i);
+        return;
+    }
+
+    if (!num_jobs)
+        return;
+
+    mtx_lock(&run_lock);
+    mtx_lock(&lock);
+
+    //Split the jobs evenly between the workers to begin with; stealing evens things out afterwards
+    const uint32_t jobs_per_worker = num_jobs / num_workers;
+    const uint32_t excess_jobs = num_jobs % num_workers;
+    uint32_t next_job_num = 0;
+    for (uint16_t i = 0; i < num_workers; ++i)
+    {
+        uint32_t count = jobs_per_worker + ((i < excess_jobs) ? 1 : 0);
+
+        mtx_lock(&deques[i].lock);
+        deques[i].front = next_job_num;
+        deques[i].back = next_job_num + count;
+        mtx_unlock(&deques[i].lock);
+
+        next_job_num += count;
+    }
+
+    current_job = job;
+    current_data = data;
+    workers_busy = num_workers;
+    ++run_generation;
+    cnd_broadcast(&work_available);
+
+    //Sleep (rather than spin) until the last worker runs out of jobs to do or steal
+    while (workers_busy)
+        cnd_wait(&work_done, &lock);
+
+    mtx_unlock(&lock);
+    mtx_unlock(&run_lock);
+}
+
+uint16_t pool_threads(void)
+{
+    return num_workers ? num_workers : 1;
+}
+
+uint16_t pool_worker_num(void)
+{
+    return this_worker_num;
+}
+
+void pool_destroy(void)
+{
+    if (!num_workers)
+        return;
+
+    mtx_lock(&lock);
+    shutting_down = true;
+    cnd_broadcast(&work_available);
+    mtx_unlock(&lock);
+
+    for (uint16_t i = 0; i < num_workers; ++i)
+        thrd_join(workers[i], NULL);
+
+    for (uint16_t i = 0; i < num_workers; ++i)
+        mtx_destroy(&deques[i].lock);
+
+    free(workers);
+    free(deques);
+    workers = NULL;
+    deques = NULL;
+    num_workers = 0;
+    shutting_down = false;
+}
+
+/* Static Function Implementations */
+
+static void pool_init_once(void)
+{
+    mtx_init(&run_lock, mtx_plain);
+    mtx_init(&lock, mtx_plain);
+    cnd_init(&work_available);
+    cnd_init(&work_done);
+    atexit(pool_destroy);
+}
+
+static int worker_thread(void* worker_num_)
+{
+    const uint16_t worker_num = (uint16_t)(uintptr_t)worker_num_;
+    this_worker_num = worker_num;
+
+    mtx_lock(&lock);
+    uint64_t seen_generation = creation_generation;//Only pick up runs started after we were created
+    while (true)
+    {
+        while (!shutting_down && (seen_generation == run_generation))
+            cnd_wait(&work_available, &lock);
+
+        if (shutting_down)
+            break;
+
+        seen_generation = run_generation;
+        pool_job_t job = current_job;
+        void* data = current_data;
+        mtx_unlock(&lock);
+
+        //Work through our own jobs, then help out whoever has the most left
+        uint32_t job_num;
+        do
+        {
+            while (pop_own_job(worker_num, &job_num))
+                job(data, job_num);
+        } while (steal_jobs(worker_num));
+
+        mtx_lock(&lock);
+        if (!--workers_busy)
+            cnd_signal(&work_done);
+    }
+    mtx_unlock(&lock);
+
+    return 0;
+}
+
+static bool pop_own_job(uint16_t worker_num, uint32_t* job_num)
+{
+    job_deque_t* deque = &deques[worker_num];
+    bool got_job = false;
+
+    mtx_lock(&deque->lock);
+    if (deque->front < deque->back)
+    {
+        *job_num = deque->front++;
+        got_job = true;
+    }
+    mtx_unlock(&deque->lock);
+
+    return got_job;
+}
+
+static bool steal_jobs(uint16_t worker_num)
+{
+    //Find the victim with the most remaining jobs (only a snapshot; it is rechecked under the victim's lock)
+    uint16_t victim_num = worker_num;
+    uint32_t most_remaining = 0;
+    for (uint16_t i = 1; i < num_workers; ++i)
+    {
+        uint16_t candidate = (worker_num + i) % num_workers;
+
+        mtx_lock(&deques[candidate].lock);
+        uint32_t remaining = deques[candidate].back - deques[candidate].front;
+        mtx_unlock(&deques[candidate].lock);
+
+        if (remaining > most_remaining)
+        {
+            most_remaining = remaining;
+            victim_num = candidate;
+        }
+    }
+
+    if (victim_num == worker_num)
+        return false;//Nothing left anywhere
+
+    //Take the back half of the victim's jobs (at least one) into our own (empty) deque
+    job_deque_t* victim = &deques[victim_num];
+    uint32_t stolen_front, stolen_back;
+
+    mtx_lock(&victim->lock);
+    uint32_t remaining = victim->back - victim->front;
+    uint32_t to_steal = (remaining + 1) / 2;
+    stolen_back = victim->back;
+    victim->back -= to_steal;
+    stolen_front = victim->back;
+    mtx_unlock(&victim->lock);
+
+    if (!to_steal)
+        return true;//Someone beat us to it; look again
+
+    job_deque_t* own = &deques[worker_num];
+    mtx_lock(&own->lock);
+    own->front = stolen_front;
+    own->back = stolen_back;
+    mtx_unlock(&own->lock);
+
+    return true;
+}
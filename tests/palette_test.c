@@ -0,0 +1,75 @@
+/* Palette compiling tests
+ * By: John Jekel
+ *
+ * Colouring a pixel is a lookup in the compiled tables, so an 8 or 4 bit render gets the same colours as a 24 bit one
+ * exactly when every intensity's indexed colour matches its 24 bit colour (for palettes small enough not to be sampled)
+*/
+
+/* Includes */
+
+#include "palette.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Static Function Declarations */
+
+static bool check_palette(const char* name, palette_colour_t inside, uint32_t num_colours, uint_fast16_t max_colours, uint16_t max_iterations);
+
+/* Function Implementations */
+
+int main(void)
+{
+    bool success = true;
+    const palette_colour_t black = {.r = 0, .g = 0, .b = 0, .a = 0};
+
+    //The last colour is the same as the inside one (like example.pal), a middle one is, or none are
+    for (uint16_t max_iterations = 1; max_iterations <= 4096; max_iterations *= 4)
+    {
+        success &= check_palette("last is inside (8 bit)", black, 11, 256, max_iterations);
+        success &= check_palette("last is inside (4 bit)", black, 11, 16, max_iterations);
+        success &= check_palette("middle is inside (8 bit)", (palette_colour_t){.r = 5, .g = 5, .b = 5, .a = 0}, 11, 256, max_iterations);
+        success &= check_palette("inside appended (8 bit)", (palette_colour_t){.r = 1, .g = 2, .b = 3, .a = 0}, 11, 256, max_iterations);
+        success &= check_palette("inside appended (4 bit)", (palette_colour_t){.r = 1, .g = 2, .b = 3, .a = 0}, 15, 16, max_iterations);
+    }
+
+    return success ? 0 : 1;
+}
+
+/* Static Function Implementations */
+
+static bool check_palette(const char* name, palette_colour_t inside, uint32_t num_colours, uint_fast16_t max_colours, uint16_t max_iterations)
+{
+    //A ramp from white down to black, in the stretch mapping
+    palette_colour_t colours[256];
+    for (uint32_t i = 0; i < num_colours; ++i)
+    {
+        const uint8_t shade = 255 - ((i * 255) / (num_colours - 1));
+        colours[i] = (palette_colour_t){.r = shade, .g = shade, .b = shade, .a = 0};
+    }
+    const palette_t palette = {.mapping = PALETTE_STRETCH, .inside = inside, .num_colours = num_colours, .colours = colours};
+
+    uint32_t* colours_24 = (uint32_t*) malloc(sizeof(uint32_t) * (max_iterations + 1));
+    uint8_t* indices = (uint8_t*) malloc(sizeof(uint8_t) * (max_iterations + 1));
+    palette_colour_t bmp_palette[256];
+    palette_compile_24(&palette, max_iterations, colours_24);
+    const uint_fast16_t num_bmp_colours = palette_compile_indexed(&palette, max_iterations, indices, bmp_palette, max_colours);
+
+    uint32_t mismatches = 0;
+    for (uint32_t intensity = 0; intensity <= max_iterations; ++intensity)
+    {
+        const palette_colour_t colour = bmp_palette[indices[intensity]];
+        if ((indices[intensity] >= num_bmp_colours) || (colours_24[intensity] != (colour.b | (colour.g << 8) | ((uint32_t) colour.r << 16))))
+            ++mismatches;
+    }
+
+    free(colours_24);
+    free(indices);
+
+    if (mismatches)
+        fprintf(stderr, "%s, %hu iterations: %" PRIu32 " of %u intensities have the wrong colour\n", name, max_iterations, mismatches, max_iterations + 1);
+    return !mismatches;
+}